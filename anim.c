@@ -0,0 +1,261 @@
+/*
+ * File:    anim.c
+ * Description: Background animation programs and the engine that steps
+ *              them once a revolution, see anim.h.
+ */
+
+#include <stddef.h>
+#include <avr/pgmspace.h>
+
+#include "anim.h"
+#include "layers.h"
+
+/* Most jumps taken entering a step, stops a program that only jumps */
+#define ANIM_MAX_JUMPS  4
+
+/* Turns the background a sector every revolution */
+const AnimStep PROGMEM gAnimSpin[] =
+{   {ANIM_ROTATE, 0xFFFF, 1},
+    {ANIM_JUMP, 0, 0}
+};
+
+/* Moves the colors a channel on every 2 s */
+const AnimStep PROGMEM gAnimColors[] =
+{   {ANIM_CYCLE, 2 * TARGET_RPS, 0},
+    {ANIM_JUMP, 0, 0}
+};
+
+/* Shows each background for 10 s, then wipes in the next over 1 s */
+const AnimStep PROGMEM gAnimSlides[] =
+{   {ANIM_HOLD, 10 * TARGET_RPS, 0},
+    {ANIM_WIPE, TARGET_RPS, 0},
+    {ANIM_JUMP, 0, 0}
+};
+
+/* On the hour, a white flash for every hour */
+const AnimStep PROGMEM gAnimChime[] =
+{   {ANIM_FLASH, 6, RGB_WHITE},
+    {ANIM_HOLD, 18, 0},
+    {ANIM_CHIME, 0, 0},
+    {ANIM_END, 0, 0}
+};
+
+const AnimStep * const PROGMEM gAnimations[NUM_ANIMATIONS] =
+{   NULL, gAnimSpin, gAnimColors, gAnimSlides
+};
+
+const AnimStep *gAnimProgram = NULL;    /* Running, NULL for none */
+AnimStep gAnimCur;                      /* Its current step */
+uint8_t gAnimIndex;
+uint16_t gAnimRevs;                     /* Revolutions into the step */
+uint16_t gAnimAcc;
+uint8_t gAnimSelected = 0;              /* Runs again after a chime */
+uint8_t gAnimChimes = 0;
+uint8_t gAnimLast = 0;                  /* gRotations last seen */
+
+/* What the steps have done to the background, read by compose_frame */
+sector_t gAnimOffset = 0;               /* Sectors turned */
+uint8_t gAnimCycle = 0;                 /* Channels moved on, 0..2 */
+uint8_t gAnimShift = 0;                 /* Backgrounds wiped on */
+sector_t gAnimWipe = 0;                 /* Sectors of the next one shown */
+uint8_t gAnimFlashing = 0;
+color_t gAnimFlash;
+
+
+/*
+ * Function:    enter_step
+ * -----------------------
+ *  Starts a step of the running program. Jumps and chimes are taken
+ *  straight away, up to ANIM_MAX_JUMPS of them. Returns 0 if the
+ *  program ended instead.
+ *
+ *  Modifies: gAnimCur, gAnimIndex, gAnimRevs, gAnimAcc, gAnimChimes,
+ *            gAnimCycle, gAnimWipe, gAnimFlashing, gAnimFlash
+ */
+uint8_t enter_step(uint8_t index)
+{
+    for (uint8_t jumps = 0; jumps < ANIM_MAX_JUMPS; jumps++)
+    {
+        memcpy_P(&gAnimCur, &gAnimProgram[index], sizeof(AnimStep));
+        gAnimIndex = index;
+        gAnimRevs = 0;
+        gAnimAcc = 0;
+
+        switch (gAnimCur.op)
+        {
+        case ANIM_END:
+            return 0;
+        case ANIM_JUMP:
+            index = gAnimCur.value;
+            continue;
+        case ANIM_CHIME:
+            if (gAnimChimes > 1)
+            {
+                gAnimChimes--;
+                index = gAnimCur.value;
+            }
+            else
+                index++;
+            continue;
+        case ANIM_CYCLE:
+            gAnimCycle = gAnimCycle == 2 ? 0 : gAnimCycle + 1;
+            layers_changed();
+            break;
+        case ANIM_WIPE:
+            gAnimWipe = 0;
+            break;
+        case ANIM_FLASH:
+            gAnimFlashing = 1;
+            gAnimFlash = gAnimCur.value;
+            layers_changed();
+            break;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+
+/*
+ * Function:    leave_step
+ * -----------------------
+ *  Finishes the current step, a wipe leaves the next background in
+ *  place and a flash goes off.
+ *
+ *  Modifies: gAnimShift, gAnimWipe, gAnimFlashing
+ */
+void leave_step(void)
+{
+    if (gAnimCur.op == ANIM_WIPE)
+    {
+        gAnimShift++;
+        gAnimWipe = 0;
+        layers_changed();
+    }
+    else if (gAnimCur.op == ANIM_FLASH)
+    {
+        gAnimFlashing = 0;
+        layers_changed();
+    }
+}
+
+
+/*
+ * Function:    anim_start
+ * -----------------------
+ *  Starts a program from gAnimations, 0 stops the animation. The
+ *  background goes back to how it was drawn.
+ *
+ *  Modifies: animation state
+ */
+void anim_start(uint8_t animation)
+{
+    gAnimSelected = animation;
+    gAnimOffset = 0;
+    gAnimCycle = 0;
+    gAnimShift = 0;
+    gAnimWipe = 0;
+    gAnimFlashing = 0;
+    layers_changed();
+
+    gAnimProgram = pgm_read_ptr(&gAnimations[animation]);
+    if (gAnimProgram && !enter_step(0))
+        gAnimProgram = NULL;
+}
+
+
+/*
+ * Function:    anim_chime
+ * -----------------------
+ *  Plays the chime, a flash for each of chimes, over whatever program
+ *  is running. That program starts again afterwards.
+ *
+ *  Modifies: animation state
+ */
+void anim_chime(uint8_t chimes)
+{
+    if (!chimes)
+        return;
+
+    if (gAnimProgram)
+        leave_step();
+    gAnimChimes = chimes;
+    gAnimProgram = gAnimChime;
+    if (!enter_step(0))
+        anim_start(gAnimSelected);
+}
+
+
+/*
+ * Function:    anim_revolution
+ * ----------------------------
+ *  Advances the running program by one revolution. A rotation moves
+ *  the offset on, a wipe hands out its RESOLUTION sectors evenly over
+ *  the revolutions it lasts.
+ *
+ *  Modifies: animation state
+ */
+void anim_revolution(void)
+{
+    if (gAnimCur.op == ANIM_ROTATE && gAnimCur.value)
+    {
+        gAnimOffset += gAnimCur.value % RESOLUTION;
+        if (gAnimOffset >= RESOLUTION)
+            gAnimOffset -= RESOLUTION;
+        layers_changed();
+    }
+    else if (gAnimCur.op == ANIM_WIPE)
+    {
+        gAnimAcc += RESOLUTION;
+        while (gAnimAcc >= gAnimCur.revs && gAnimWipe < RESOLUTION)
+        {
+            gAnimAcc -= gAnimCur.revs;
+            gAnimWipe++;
+            layers_changed();
+        }
+    }
+
+    if (++gAnimRevs < gAnimCur.revs)
+        return;
+
+    leave_step();
+    if (enter_step(gAnimIndex + 1))
+        return;
+
+    if (gAnimProgram == gAnimChime)
+        anim_start(gAnimSelected);
+    else
+        gAnimProgram = NULL;
+}
+
+
+/*
+ * Function:    anim_update
+ * ------------------------
+ *  Runs the animation on for the revolutions since the last call.
+ *  Takes the count of revolutions so far, it wraps.
+ *
+ *  Modifies: gAnimLast, animation state
+ */
+void anim_update(uint8_t revolutions)
+{
+    uint8_t revs = revolutions - gAnimLast;
+
+    gAnimLast = revolutions;
+    while (revs-- && gAnimProgram)
+        anim_revolution();
+}
+
+
+/*
+ * Function:    anim_color
+ * -----------------------
+ *  Returns a background color with its channels moved on by the color
+ *  cycle, red into green, green into blue and blue into red.
+ */
+color_t anim_color(color_t color)
+{
+    for (uint8_t i = 0; i < gAnimCycle; i++)
+        color = (color >> 4) | ((color & 0x0F) << 8);
+    return color;
+}
@@ -0,0 +1,57 @@
+#ifndef ANIM_H
+#define ANIM_H
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+#include "constants.h"
+
+/*
+ * Background animations. A program is a PROGMEM list of steps, each
+ * lasting revs revolutions. The main loop advances it once for every
+ * revolution the platter makes, and each revolution only adds on to
+ * where the last left off, so a step costs the same however long it
+ * runs. The frame is composed again only when the step changed what is
+ * shown, the sector ISR never sees any of it.
+ *
+ *  ANIM_HOLD    -- shows the background as it is
+ *  ANIM_ROTATE  -- turns the background value sectors a revolution
+ *  ANIM_CYCLE   -- moves the colors one channel on, red to green to
+ *                  blue, then holds
+ *  ANIM_WIPE    -- wipes the next background in clockwise from 12
+ *  ANIM_FLASH   -- fills the display with the color in value
+ *  ANIM_CHIME   -- goes back to step value until the chimes are done
+ *  ANIM_JUMP    -- goes on at step value, takes no revolutions
+ *  ANIM_END     -- the program is over
+ */
+#define ANIM_END        0
+#define ANIM_HOLD       1
+#define ANIM_ROTATE     2
+#define ANIM_CYCLE      3
+#define ANIM_WIPE       4
+#define ANIM_FLASH      5
+#define ANIM_CHIME      6
+#define ANIM_JUMP       7
+
+/* Programs that can be picked, 0 is none */
+#define NUM_ANIMATIONS  4
+
+typedef struct AnimStep
+{
+    uint8_t op;
+    uint16_t revs;
+    uint16_t value;
+} AnimStep;
+
+extern sector_t gAnimOffset;
+extern uint8_t gAnimShift;
+extern sector_t gAnimWipe;
+extern uint8_t gAnimFlashing;
+extern color_t gAnimFlash;
+
+void anim_start(uint8_t animation);
+void anim_chime(uint8_t chimes);
+void anim_update(uint8_t revolutions);
+color_t anim_color(color_t color);
+
+#endif
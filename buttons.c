@@ -0,0 +1,141 @@
+/*
+ * File:    buttons.c
+ * Description: Debounced buttons, sampled from the timer tick.
+ *
+ * Each button has an integrator that counts up while the pin reads
+ * pressed and down while it reads released, the debounced state only
+ * changes when it reaches either end. A bounce shorter than
+ * BUTTON_INTEGRATOR ticks never gets there. Events are queued for the
+ * main loop to take with button_event.
+ */
+
+#include <avr/io.h>
+
+#include "buttons.h"
+
+const uint8_t gButtonPins[NUM_BUTTONS] = {BUTTON1, BUTTON2, BUTTON3};
+
+uint8_t gButtonIntegrator[NUM_BUTTONS];
+uint8_t gButtonDown[NUM_BUTTONS];           /* Debounced state */
+uint8_t gButtonHeld[NUM_BUTTONS];           /* Ticks since the press */
+
+uint8_t gButtonQueue[BUTTON_QUEUE_SIZE];
+volatile uint8_t gButtonHead = 0;
+volatile uint8_t gButtonTail = 0;
+
+
+/*
+ * Function:    buttons_init
+ * -------------------------
+ *  Turns on the pullups for the button inputs, the buttons pull them
+ *  low when pressed.
+ *
+ *  Modifies: PORTA
+ */
+void buttons_init(void)
+{
+    for (uint8_t i = 0; i < NUM_BUTTONS; i++)
+        PORTA |= (1 << gButtonPins[i]);
+}
+
+
+/*
+ * Function:    push_event
+ * -----------------------
+ *  Queues an event, it is dropped if the main loop has fallen that far
+ *  behind.
+ *
+ *  Modifies: gButtonQueue, gButtonHead
+ */
+void push_event(uint8_t event)
+{
+    uint8_t head = gButtonHead;
+    uint8_t next = (head + 1) & (BUTTON_QUEUE_SIZE - 1);
+
+    if (next != gButtonTail)
+    {
+        gButtonQueue[head] = event;
+        gButtonHead = next;
+    }
+}
+
+
+/*
+ * Function:    sample_button
+ * --------------------------
+ *  Feeds one sample of a button into its integrator and queues the
+ *  events it makes.
+ *
+ *  Modifies: gButtonIntegrator, gButtonDown, gButtonHeld, gButtonQueue
+ */
+void sample_button(uint8_t i, uint8_t pressed)
+{
+    if (pressed)
+    {
+        if (gButtonIntegrator[i] < BUTTON_INTEGRATOR)
+            gButtonIntegrator[i]++;
+    }
+    else if (gButtonIntegrator[i])
+        gButtonIntegrator[i]--;
+
+    if (!gButtonDown[i])
+    {
+        if (gButtonIntegrator[i] == BUTTON_INTEGRATOR)
+        {
+            gButtonDown[i] = 1;
+            gButtonHeld[i] = 0;
+            push_event(i | BUTTON_PRESS);
+        }
+        return;
+    }
+
+    if (gButtonIntegrator[i] == 0)
+    {
+        gButtonDown[i] = 0;
+        return;
+    }
+
+    if (++gButtonHeld[i] == BUTTON_LONG_TICKS)
+        push_event(i | BUTTON_LONG);
+    else if (gButtonHeld[i] == BUTTON_LONG_TICKS + BUTTON_REPEAT_TICKS)
+    {
+        gButtonHeld[i] = BUTTON_LONG_TICKS;
+        push_event(i | BUTTON_REPEAT);
+    }
+}
+
+
+/*
+ * Function:    buttons_tick
+ * -------------------------
+ *  Samples the buttons. Called from the timer tick, TICK_HZ times a
+ *  second. Written out rather than looped so make bench can bound it.
+ */
+void buttons_tick(void)
+{
+    uint8_t pins = PINA;
+
+    sample_button(0, !(pins & (1 << BUTTON1)));
+    sample_button(1, !(pins & (1 << BUTTON2)));
+    sample_button(2, !(pins & (1 << BUTTON3)));
+}
+
+
+/*
+ * Function:    button_event
+ * -------------------------
+ *  Takes the oldest queued event. Returns BUTTON_NONE if there is none.
+ *
+ *  Modifies: gButtonTail
+ */
+uint8_t button_event(void)
+{
+    uint8_t tail = gButtonTail;
+    uint8_t event;
+
+    if (tail == gButtonHead)
+        return BUTTON_NONE;
+    event = gButtonQueue[tail];
+    gButtonTail = (tail + 1) & (BUTTON_QUEUE_SIZE - 1);
+    return event;
+}
@@ -0,0 +1,27 @@
+#ifndef BUTTONS_H
+#define BUTTONS_H
+
+#include <stdint.h>
+
+#include "constants.h"
+
+/*
+ * An event is the button index, 0..NUM_BUTTONS-1, or'd with what
+ * happened to it. PRESS comes as soon as the button is down, LONG once
+ * it has been held BUTTON_LONG_TICKS, then REPEAT every
+ * BUTTON_REPEAT_TICKS until it is let go.
+ */
+#define BUTTON_PRESS    0x00
+#define BUTTON_LONG     0x40
+#define BUTTON_REPEAT   0x80
+#define BUTTON_TYPE     0xC0
+#define BUTTON_NONE     0xFF
+
+/* Events that can wait for the main loop, must be a power of 2 */
+#define BUTTON_QUEUE_SIZE 8
+
+void buttons_init(void);
+void buttons_tick(void);
+uint8_t button_event(void);
+
+#endif
@@ -8,95 +8,217 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
-#include <avr/eeprom.h>
 #include <avr/pgmspace.h>
+#include <util/atomic.h>
 #include <util/delay.h>
 
+#include "anim.h"
 #include "backgrounds.h"
+#include "buttons.h"
 #include "constants.h"
+#include "governor.h"
+#include "hal.h"
+#include "hands.h"
 #include "i2c.h"
+#include "layers.h"
+#include "rtc.h"
+#include "sched.h"
+#include "settings.h"
+#include "stats.h"
+#include "trace.h"
+#include "uart.h"
 
 
-void set_duty_cycle(uint16_t width);
 void init_ESC(void);
 void set_color(uint8_t color);
 void increment_mode(void);
 void increment_hour(void);
 void increment_minute(void);
 void change_background(void);
+void change_animation(void);
 void change_hour_color(void);
 void change_minute_color(void);
 void change_second_color(void);
-void calculate_hour_position(void);
-void calculate_minute_position(void);
-void calculate_second_position(void);
-void read_time(void);
-void update_ds1307(void);
-uint8_t bcd2bin(uint8_t);
-uint8_t bin2bcd(uint8_t);
+void turn_phase(void);
+void raise_latency(void);
+void update_rotation(void);
+void update_resolution(void);
+void update_timing(uint8_t frame);
+void sweep_second_hand(void);
+void update_hands(void);
+void poll_commands(void);
+void handle_command(const char *line);
+void send_telemetry(void);
+void handle_button(uint8_t event);
+void start_blink(const uint8_t *pattern);
+void blink_tick(void);
+void settings_changed(void);
+void load_settings(void);
+void task_rtc(void);
+void task_display(void);
+void task_input(void);
+void task_telemetry(void);
+void task_trace(void);
+void task_stats(void);
+void task_governor(void);
+void task_save(void);
 
 
 void (*gButtonHandlers[NUM_MODES][NUM_BUTTONS])(void) =
 {   {increment_mode, NULL, NULL},
-    {increment_mode, NULL, change_background},
+    {increment_mode, change_animation, change_background},
     {increment_mode, increment_hour, change_hour_color},
     {increment_mode, increment_minute, change_minute_color},
-    {increment_mode, NULL, change_second_color}
+    {increment_mode, NULL, change_second_color},
+    {increment_mode, turn_phase, raise_latency}
 };
 
-typedef struct Hand
-{
-    uint8_t value;
-    uint8_t color;
-    uint8_t pos1;
-    uint8_t pos2;
-} Hand;
+/* Buttons whose handler runs again while held, a bit per button */
+const uint8_t gButtonRepeats[NUM_MODES] = {0, 0, (1 << 1), (1 << 1), 0,
+                                           (1 << 1) | (1 << 2)};
+
+/*
+ * Mode change blinks, tick lengths alternately white and off, ending
+ * in 0. gBlink walks the pattern from the tick, gModeFlag keeps the
+ * display off the LEDs meanwhile.
+ */
+const uint8_t gBlinkMode[] = {BLINK_LONG, BLINK_LONG, 0};
+const uint8_t gBlinkNormal[] = {BLINK_SHORT, BLINK_SHORT,
+                                BLINK_LONG, BLINK_LONG, 0};
+const uint8_t * volatile gBlink = NULL;
+uint8_t gBlinkTicks;
+uint8_t gBlinkOn;
 
 Hand gHourHand;
 Hand gMinuteHand;
 Hand gSecondHand;
 
-
-struct RTCDate
-{
-    uint8_t seconds;
-    uint8_t minutes;
-    uint8_t hours;
-    uint8_t weekday;
-    uint8_t date;
-    uint8_t month;
-    uint8_t year;
-} gDate;
+/*
+ * Second hand sweep. The SECTORS_PER_SECOND steps of a second are
+ * spread over its revolutions, gSweepAcc hands them out gSweepRate
+ * revolutions apart. gSweepRate is how many revolutions the last
+ * whole second took, counted from gRotations.
+ */
+uint8_t gSweepSecond = 0xFF;        /* Second the steps belong to */
+uint8_t gSweepRevs = 0;             /* gRotations at the last sweep */
+uint8_t gSweepCount = 0;            /* Revolutions into the second */
+uint8_t gSweepRate = TARGET_RPS;
+uint8_t gSweepAcc = 0;
+uint8_t gSweepStep = 0;             /* 0..SECTORS_PER_SECOND - 1 */
+
+void draw_background(uint8_t *frame, uint8_t base, uint8_t background,
+                     sector_t limit);
+void compose_frame(uint8_t *frame);
+
+
+/* Serial command being received */
+char gCommand[COMMAND_SIZE];
+uint8_t gCommandLen = 0;
+
+/* Scheduler tasks that are started and stopped on demand */
+uint8_t gTelemetryTask;
+uint8_t gSaveTask;
+#ifdef TRACE
+uint8_t gTraceTask;
+#endif
+#ifdef STATS
+uint8_t gStatsTask;
+#endif
 
 
-uint8_t gCycleColor[] = {OFF, RED, PURPLE, BLUE, CYAN, GREEN, YELLOW, WHITE};
+const color_t PROGMEM gCycleColor[NUM_COLORS] =
+{   RGB_OFF, RGB_RED, RGB_PURPLE, RGB_BLUE,
+    RGB_CYAN, RGB_GREEN, RGB_YELLOW, RGB_WHITE,
+#if BCM_BITS > 1
+    RGB(15, 8, 0), RGB(15, 0, 8), RGB(0, 8, 15),
+    RGB(8, 15, 0), RGB(8, 8, 8), RGB(4, 0, 0)
+#endif
+};
 uint8_t gMode = 0;
 uint8_t gModeFlag = 0;
-uint8_t gPlatterPos = 0;
-uint8_t gRotations = 0;
+volatile sector_t gPlatterPos = 0;
+uint8_t gSlot = 0;
+volatile uint8_t gRotations = 0;
 uint8_t gBackground;
+uint8_t gAnimation;
+uint8_t gChimeHour = 0xFF;
 
+/* Display phase, see constants.h */
+uint16_t gPhase;                        /* Sectors */
+uint16_t gLatency;                      /* Microseconds */
+uint8_t gLatencySectors = 0;            /* Turned at the current speed */
+Layer *gCalMarks;
 
 /*
- * Function:    bcd2bin
- * --------------------
- *  Converts the Binary-coded decimal form of a number to the binary form.
- *  EX: 0x16 BCD
- *  ------------
- *      16 - (6 * (16 / 16)) => 0x10 == 16
+ * Double buffered frame of final PORTD values, BCM_BITS per sector, one
+ * for each slot. The sector ISR only ever reads gFrontFrame, the main
+ * loop composes into gBackFrame and the hall sensor capture swaps them
+ * at the revolution boundary. gPlatterPos indexes it.
  */
-uint8_t bcd2bin (uint8_t val) { return val - 6 * (val >> 4); }
+uint8_t gFrames[2][FRAME_SIZE];
+uint8_t * volatile gFrontFrame = gFrames[0];
+uint8_t * volatile gBackFrame = gFrames[1];
+volatile uint8_t gFrameReady = 0;
 
+/*
+ * Sectors each frame is shown in, RESOLUTION / gSectorDiv when it was
+ * composed. gFrameLast is the last slot of the front frame.
+ */
+volatile sector_t gBackSectors = RESOLUTION;
+sector_t gFrontSectors = RESOLUTION;
+sector_t gFrameLast = FRAME_SIZE - 1;
+const uint8_t PROGMEM gSectorDivisors[] = SECTOR_DIVISORS;
 
 /*
- * Function:    bin2bcd
- * --------------------
- *  Converts the binary form of a number to the Binary-coded decimal form.
- *  EX: 18 binary == 0x12
- *  ---------------------
- *      12 + (6 * (12 / 10)) => 12 + 6 * 1 => 0x18 BCD
+ * PORTD value for the next slot, read by the naked entry of the sector
+ * ISR so it can be written before anything else. The ISR body loads it
+ * from the frame one slot ahead. While gModeFlag is set the body leaves
+ * it alone and set_color keeps it the same as PORTD.
  */
-uint8_t bin2bcd (uint8_t val) { return val + 6 * (val / 10); }
+volatile uint8_t gSectorPort = 0;
+
+/*
+ * Revolution timing. TIMER 1 and TIMER 0 both run at F_CPU / 8 so the
+ * measured period splits straight into TIMER 0 sector lengths. Each
+ * sector is gSectorOcr + 1 ticks long, and gSectorRem of them get one
+ * extra tick, spread out by gSectorAcc, so the gFrontSectors sectors
+ * add up to exactly one revolution, gSectorRest is gFrontSectors less
+ * gSectorRem. A sector is cut into BCM_BITS slots of gSlotOcr[slot] + 1
+ * ticks, weighted 1, 2, 4.., the extra tick goes on the last slot. A
+ * platter too slow for that runs TIMER 0 on the slower gSectorClock.
+ * The period is gRevOverflows * 65536 + gRevTicks, gRevPeriod is the
+ * same saturated at 0xFFFF.
+ */
+volatile uint16_t gLastCapture = 0;
+volatile uint8_t gT1Overflows = 0;
+uint16_t gRevPeriod = 0;
+uint16_t gRevTicks = 0;
+uint8_t gRevOverflows = 0;
+sector_t gRevSlots = 0;
+uint8_t gSectorClock = SECTOR_CLOCK_8;
+uint8_t gSectorOcr = SECTOR_TICKS - 1;
+sector_t gSectorRem = 0;
+sector_t gSectorRest = RESOLUTION;
+uint8_t gSectorFlags = 0;
+sector_t gSectorAcc = 0;
+uint8_t gSectorCarry = 0;
+uint8_t gSlotOcr[BCM_BITS] = {SECTOR_TICKS - 1};
+
+/*
+ * The same for the coming revolutions, worked out from the period by
+ * update_timing in the main loop so the capture ISR never divides. The
+ * ISR takes them at the next capture once gTimingReady is set.
+ * gSectorShifts is how many bits slower each TIMER 0 clock is than
+ * F_CPU / 8.
+ */
+uint8_t gNextClock;
+uint8_t gNextOcr;
+sector_t gNextRem;
+sector_t gNextRest;
+uint8_t gNextFlags;
+uint8_t gNextSlotOcr[BCM_BITS];
+volatile uint8_t gTimingReady = 0;
+const uint8_t PROGMEM gSectorShifts[] = {0, 3, 5, 7};
 
 
 /*
@@ -105,25 +227,77 @@ uint8_t bin2bcd (uint8_t val) { return val + 6 * (val / 10); }
  *  Cycles through various modes of operation and blinks a white light
  *  to indicate which mode. This function is the button handler for
  *  button 1 presses and modifies the index(gMode) for selecting the
- *  correct button handlers for other modes.
+ *  correct button handlers for other modes. The blink runs from the
+ *  timer tick, this returns straight away.
  *  Modes are in order:
- *      NORMAL, BACKGROUND EDIT, HOUR EDIT, MINUTE EDIT, SECOND EDIT
+ *      NORMAL, BACKGROUND EDIT, HOUR EDIT, MINUTE EDIT, SECOND EDIT,
+ *      CALIBRATE
  *
- *  Modifies: gModeFlag, gMode, LED color
+ *  Modifies: gMode, gBlink
  */
 void increment_mode(void)
 {
-    gModeFlag = 1;
     gMode++;
     if (gMode >= NUM_MODES)
     {
-        set_color(WHITE);_delay_ms(100);
-        set_color(OFF);_delay_ms(100);
         gMode = 0;
+        start_blink(gBlinkNormal);
+    }
+    else
+        start_blink(gBlinkMode);
+}
+
+
+/*
+ * Function:    start_blink
+ * ------------------------
+ *  Takes the LEDs off the display and starts blinking them white in
+ *  the given pattern.
+ *
+ *  Modifies: gBlink, gBlinkTicks, gBlinkOn, gModeFlag, LED color
+ */
+void start_blink(const uint8_t *pattern)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        gModeFlag = 1;
+        gBlinkTicks = pattern[0];
+        gBlinkOn = 1;
+        gBlink = pattern;
+        set_color(WHITE);
+    }
+}
+
+
+/*
+ * Function:    blink_tick
+ * -----------------------
+ *  Steps the mode change blink. Called from the timer tick. Once the
+ *  pattern ends the display gets the LEDs back.
+ *
+ *  Modifies: gBlink, gBlinkTicks, gBlinkOn, gModeFlag, LED color
+ */
+void blink_tick(void)
+{
+    const uint8_t *blink = gBlink;
+
+    if (!blink || --gBlinkTicks)
+        return;
+
+    blink++;
+    if (*blink)
+    {
+        gBlinkTicks = *blink;
+        gBlinkOn = !gBlinkOn;
+        gBlink = blink;
+        set_color(gBlinkOn ? WHITE : OFF);
+    }
+    else
+    {
+        gBlink = NULL;
+        set_color(OFF);
+        gModeFlag = 0;
     }
-    set_color(WHITE);_delay_ms(250);
-    set_color(OFF);_delay_ms(250);
-    gModeFlag = 0;
 }
 
 
@@ -131,17 +305,79 @@ void increment_mode(void)
  * Function:    change_background
  * ------------------------------
  *  Cycles through the different backgrounds defined in 'backgrounds.h'
- *  and saves the value in EEPROM memory. This function is the button
- *  handler for button 3 when in BACKGROUND EDIT mode
+ *  and saves the value in EEPROM memory a little later. This function
+ *  is the button handler for button 3 when in BACKGROUND EDIT mode
  *
- *  Modifies: gBackground, *EEPROM_BACKGROUND_ADDR
+ *  Modifies: gBackground
+ *  Calls: settings_changed
  */
 void change_background(void)
 {
     gBackground++;
     if (gBackground >= NUM_BACKGROUNDS)
         gBackground = 0;
-    eeprom_write_byte((uint8_t *)EEPROM_BACKGROUND_ADDR, gBackground);
+    layers_changed();
+    settings_changed();
+}
+
+
+/*
+ * Function:    change_animation
+ * -----------------------------
+ *  Cycles through the background animations in anim.c, 0 is none, and
+ *  saves the value in EEPROM memory a little later. This function is
+ *  the button handler for button 2 when in BACKGROUND EDIT mode
+ *
+ *  Modifies: gAnimation, animation state
+ *  Calls: settings_changed
+ */
+void change_animation(void)
+{
+    gAnimation++;
+    if (gAnimation >= NUM_ANIMATIONS)
+        gAnimation = 0;
+    anim_start(gAnimation);
+    settings_changed();
+}
+
+
+/*
+ * Function:    turn_phase
+ * -----------------------
+ *  Turns the display back one sector and saves the phase in EEPROM
+ *  memory a little later. This function is the button handler for
+ *  button 2 when in CALIBRATE mode, with the platter slow enough that
+ *  the latency hardly turns it, until the marks sit at 12, 3, 6 and 9.
+ *
+ *  Modifies: gPhase
+ *  Calls: settings_changed
+ */
+void turn_phase(void)
+{
+    gPhase++;
+    if (gPhase >= RESOLUTION)
+        gPhase = 0;
+    settings_changed();
+}
+
+
+/*
+ * Function:    raise_latency
+ * --------------------------
+ *  Raises the latency by LATENCY_STEP_US, back round to 0 past
+ *  LATENCY_MAX_US, and saves it in EEPROM memory a little later. This
+ *  function is the button handler for button 3 when in CALIBRATE mode,
+ *  at full speed, until the marks are back where turn_phase put them.
+ *
+ *  Modifies: gLatency
+ *  Calls: settings_changed
+ */
+void raise_latency(void)
+{
+    gLatency += LATENCY_STEP_US;
+    if (gLatency > LATENCY_MAX_US)
+        gLatency = 0;
+    settings_changed();
 }
 
 
@@ -152,8 +388,8 @@ void change_background(void)
  *  This function is the button handler for button 2 when in HOUR EDIT
  *  mode.
  *
- *  Modifies: gHourHand.value, gSecondHand.value
- *  Calls: update_ds1307
+ *  Modifies: gHourHand.value, gSecondHand.value, software clock
+ *  Calls: rtc_set
  */
 void increment_hour(void)
 {
@@ -162,7 +398,7 @@ void increment_hour(void)
         gHourHand.value = 1;
 
     gSecondHand.value = 0;
-    update_ds1307();
+    rtc_set(gHourHand.value, gMinuteHand.value, 0);
 }
 
 
@@ -170,18 +406,18 @@ void increment_hour(void)
  * Function:    change_hour_color
  * ------------------------------
  *  Cycles through the hour hand colors and saves the value in
- *  EEPROM memory. This function is the button handler for button 3
- *  when in HOUR EDIT mode.
- *
- *  Modifies: gHourHand.color, *EEPROM_HOUR_ADDR
+ *  EEPROM memory a little later. This function is the button handler
+ *  for button 3 when in HOUR EDIT mode.
  *
+ *  Modifies: gHourHand.color
+ *  Calls: settings_changed
  */
 void change_hour_color(void)
 {
     gHourHand.color++;
     if (gHourHand.color >= NUM_COLORS)
         gHourHand.color = 0;
-    eeprom_write_byte((uint8_t *)EEPROM_HOUR_ADDR, gHourHand.color);
+    settings_changed();
 }
 
 
@@ -192,8 +428,8 @@ void change_hour_color(void)
  *  This function is the button handler for button 2 when in MINUTE EDIT
  *  mode.
  *
- *  Modifies: gMinuteHand.value, gSecondHand.value
- *  Calls: update_ds1307
+ *  Modifies: gMinuteHand.value, gSecondHand.value, software clock
+ *  Calls: rtc_set
  */
 void increment_minute(void)
 {
@@ -202,7 +438,7 @@ void increment_minute(void)
         gMinuteHand.value = 0;
 
     gSecondHand.value = 0;
-    update_ds1307();
+    rtc_set(gHourHand.value, gMinuteHand.value, 0);
 }
 
 
@@ -210,17 +446,18 @@ void increment_minute(void)
  * Function:    change_minute_color
  * --------------------------------
  *  Cycles through the minute hand colors and saves the value in
- *  EEPROM memory. This function is the button handler for button 3
- *  when in MINUTE EDIT mode.
+ *  EEPROM memory a little later. This function is the button handler
+ *  for button 3 when in MINUTE EDIT mode.
  *
- *  Modifies: gMinuteHand.color, *EEPROM_MINUTE_ADDR
+ *  Modifies: gMinuteHand.color
+ *  Calls: settings_changed
  */
 void change_minute_color(void)
 {
     gMinuteHand.color++;
     if (gMinuteHand.color >= NUM_COLORS)
         gMinuteHand.color = 0;
-    eeprom_write_byte((uint8_t *)EEPROM_MINUTE_ADDR, gMinuteHand.color);
+    settings_changed();
 }
 
 
@@ -228,17 +465,36 @@ void change_minute_color(void)
  * Function:    change_second_color
  * --------------------------------
  *  Cycles throuh the second hand colors and saves the value in
- *  EEPROM memory. This function is the button handler for button 3
- *  when in SECOND EDIT mode.
+ *  EEPROM memory a little later. This function is the button handler
+ *  for button 3 when in SECOND EDIT mode.
  *
- *  Modifies: gSecondHand.color, *EEPROM_SECOND_ADDR
+ *  Modifies: gSecondHand.color
+ *  Calls: settings_changed
  */
 void change_second_color(void)
 {
     gSecondHand.color++;
     if (gSecondHand.color >= NUM_COLORS)
         gSecondHand.color = 0;
-    eeprom_write_byte((uint8_t *)EEPROM_SECOND_ADDR, gSecondHand.color);
+    settings_changed();
+}
+
+
+/*
+ * Function:    update_hands
+ * -------------------------
+ *  Takes the hand values from the software clock.
+ *
+ *  Modifies: gHourHand.value, gMinuteHand.value, gSecondHand.value
+ */
+void update_hands(void)
+{
+    RTCDate date;
+
+    rtc_get(&date);
+    gHourHand.value = date.hours;
+    gMinuteHand.value = date.minutes;
+    gSecondHand.value = date.seconds;
 }
 
 
@@ -246,22 +502,20 @@ void change_second_color(void)
  * Function:    calculate_hour_position
  * ------------------------------------
  *  Calculates the position for the hour hand. This is done by
- *  taking the modulo of the current hour, and adding the fractional
- *  value of the minute hand and multiplying by sections per hour.
+ *  taking the modulo of the current hour times the sections per hour,
+ *  and adding the minutes scaled to the sections per hour. Everything
+ *  is kept in integers, there is no FPU and no need for soft float.
  *
  *  EX:  5:20
  *  ---------
- *  ((5 % 12) + (20 / 60.0)) * 15 => (5 + .33333) * 15 => 80
+ *  (5 % 12) * 15 + (20 * 15) / 60 => 75 + 5 => 80
  *
- *  Modifies: gHourHand.pos1, gHourHand.pos2
+ *  Modifies: hour hand layer
  */
 void calculate_hour_position(void)
 {
-    gHourHand.pos2 = ((gHourHand.value % 12) + (gMinuteHand.value / 60.0)) * 15;
-    if (gHourHand.pos2 == 0)
-        gHourHand.pos1 = 179;
-    else
-        gHourHand.pos1 = gHourHand.pos2 - 1;
+    place_hand(&gHourHand, (gHourHand.value % 12) * SECTORS_PER_HOUR +
+               (uint16_t)gMinuteHand.value * SECTORS_PER_HOUR / 60);
 }
 
 
@@ -269,22 +523,24 @@ void calculate_hour_position(void)
  * Function:    calculate_minute_position
  * --------------------------------------
  *  Calculates the position for the minute hand. This is done by
- *  taking the fractional value of the minute hand and multiplying
- *  by the total number of sections.
+ *  multiplying the minutes by the total number of sections and
+ *  dividing by 60. RESOLUTION is a multiple of 60 so this is exact.
+ *  With MINUTE_SWEEP the seconds are added the same way, scaled to
+ *  the sections of a minute.
  *
- *  EX: 45'
- *  -------
- *  (45 / 60.0) * 180 => 135
+ *  EX: 45' 40"
+ *  -----------
+ *  (45 * 180) / 60 + (40 * 3) / 60 => 135 + 2 => 137
  *
- *  Modifies: gMinuteHand.pos1, gMinuteHand.pos2
+ *  Modifies: minute hand layer
  */
 void calculate_minute_position(void)
 {
-    gMinuteHand.pos2 = (gMinuteHand.value / 60.0) * 180;
-    if (gMinuteHand.pos2 == 0)
-        gMinuteHand.pos1 = 179;
-    else
-        gMinuteHand.pos1 = gMinuteHand.pos2 - 1;
+    sector_t pos = (uint16_t)gMinuteHand.value * RESOLUTION / 60;
+#if MINUTE_SWEEP
+    pos += gSecondHand.value * SECTORS_PER_SECOND / 60;
+#endif
+    place_hand(&gMinuteHand, pos);
 }
 
 
@@ -292,52 +548,368 @@ void calculate_minute_position(void)
  * Function:    calculate_second_position
  * --------------------------------------
  *  Calculates the position for the second hand. This is done by
- *  taking the fractional value of the second hand and multiplying
- *  by the total number of sections.
+ *  multiplying the seconds by the total number of sections and
+ *  dividing by 60. RESOLUTION is a multiple of 60 so this is exact.
+ *  The steps the sweep has made into the second are added on.
  *
- *  EX: 30"
- *  -------
- *  (30 / 60.0) * 180 => 90
+ *  EX: 30" and 2 steps
+ *  -------------------
+ *  (30 * 180) / 60 + 2 => 92
  *
- *  Modifies: gSecondHand.pos1, gSecondHand.pos2
+ *  Modifies: second hand layer
  */
 void calculate_second_position(void)
 {
-    gSecondHand.pos2 = (gSecondHand.value / 60.0) * 180;
-    if (gSecondHand.pos2 == 0)
-        gSecondHand.pos1 = 179;
-    else
-        gSecondHand.pos1 = gSecondHand.pos2 - 1;
+    sector_t pos = (uint16_t)gSecondHand.value * RESOLUTION / 60;
+    if (gSweepSecond == gSecondHand.value)
+        pos += gSweepStep;
+    place_hand(&gSecondHand, pos);
 }
 
+
 /*
- * Function:    set_duty_cycle
- * ---------------------------
- *  Sets the PWM duty cycle for communicating with the ESC. It
- *  calculates this by taking the width, adding 50 and dividing
- *  by the length of a single PWM tick. Adding 50 is a trick for
- *  making sure the integer division rounds the correct direction.
+ * Function:    place_hand
+ * -----------------------
+ *  Moves a hand's layer so it is centered on pos, a 2 sector hand
+ *  covers pos - 1 and pos, and gives it the hand's color. Neither
+ *  makes the frame be composed again unless it changed.
+ *
+ *  Modifies: hand->layer
+ */
+void place_hand(Hand *hand, sector_t pos)
+{
+    uint16_t start = pos + RESOLUTION - hand->layer->width / 2;
+
+    if (start >= RESOLUTION)
+        start -= RESOLUTION;
+    layer_move(hand->layer, start);
+    layer_color(hand->layer, pgm_read_word(&gCycleColor[hand->color]));
+}
+
+/*
+ * Function:    sweep_second_hand
+ * ------------------------------
+ *  Steps the second hand through the second, a sector at a time, for
+ *  the revolutions since the last call. Only ever adds on, nothing is
+ *  worked out again from the time. A new second starts the steps over,
+ *  and if it follows straight on from the last the revolutions that
+ *  one took become the rate for this one. The hand never steps past
+ *  the last sector of its second, a slow 1 Hz edge leaves it waiting.
+ *
+ *  Modifies: gSweepSecond, gSweepRevs, gSweepCount, gSweepRate,
+ *            gSweepAcc, gSweepStep
+ */
+void sweep_second_hand(void)
+{
+    uint8_t revs = gRotations - gSweepRevs;
+
+    gSweepRevs += revs;
+
+    if (gSecondHand.value != gSweepSecond)
+    {
+        if (gSweepCount && gSecondHand.value ==
+            (gSweepSecond == 59 ? 0 : gSweepSecond + 1))
+            gSweepRate = gSweepCount;
+        gSweepSecond = gSecondHand.value;
+        gSweepCount = 0;
+        gSweepAcc = 0;
+        gSweepStep = 0;
+    }
+
+    while (revs--)
+    {
+        if (gSweepCount < 0xFF)
+            gSweepCount++;
+        gSweepAcc += SECTORS_PER_SECOND;
+        while (gSweepAcc >= gSweepRate)
+        {
+            gSweepAcc -= gSweepRate;
+            if (gSweepStep < SECTORS_PER_SECOND - 1)
+                gSweepStep++;
+        }
+    }
+}
+
+
+/*
+ * Function:    update_rotation
+ * ----------------------------
+ *  Sets the rotation the frame is composed with from the phase and the
+ *  sectors the latency turns at the last revolution period. Those are
+ *  worked out in 1/16 sectors and only followed once they are more than
+ *  10/16 off, so a speed right on the edge of a sector does not have
+ *  the display jumping between the two.
+ *
+ *  Modifies: gLatencySectors, layer rotation
+ */
+void update_rotation(void)
+{
+    uint16_t period;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        period = gRevPeriod;
+    }
+
+    /* TIMER 1 ticks are 1/2 us */
+    uint32_t turn = (uint32_t)gLatency * 2 * RESOLUTION * 16 /
+                    (period ? period : 1);
+    uint32_t now = (uint16_t)gLatencySectors * 16;
+    if (turn + 10 < now || turn > now + 10)
+        gLatencySectors = (turn + 8) / 16;
+
+    uint16_t back = (gPhase + gLatencySectors) % RESOLUTION;
+    layers_rotate(back ? RESOLUTION - back : 0);
+}
+
+
+/*
+ * Function:    update_resolution
+ * ------------------------------
+ *  Picks how many sectors the next frame is shown in from the last
+ *  revolution period, the most whose sectors still outlast
+ *  SECTOR_TICKS_MIN. Before the first revolution is measured it keeps
+ *  what it has.
  *
- *  Modifies: OCR2
+ *  Modifies: layer divisor
  */
-void set_duty_cycle(uint16_t width)
+void update_resolution(void)
 {
-    OCR2 = ((width + 50) / PWM_TICK_WIDTH);
+    uint16_t period;
+    uint8_t divisor;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        period = gRevPeriod;
+    }
+    if (!period)
+        return;
+
+    for (uint8_t i = 0; i < sizeof(gSectorDivisors); i++)
+    {
+        divisor = pgm_read_byte(&gSectorDivisors[i]);
+
+        uint32_t ticks = (uint32_t)period * divisor / RESOLUTION;
+        uint16_t need = SECTOR_TICKS_MIN;
+        if (divisor < gSectorDiv)
+            need += SECTOR_TICKS_MIN / 8;
+        if (ticks >= need)
+            break;
+    }
+    layers_divide(divisor);
+}
+
+
+/*
+ * Function:    update_timing
+ * --------------------------
+ *  Splits the last revolution period into the sectors the next
+ *  revolution is shown in, those of the frame waiting to be swapped in
+ *  if there is one, and leaves it for the capture ISR. TIMER 0 takes
+ *  the fastest clock whose 8 bits still hold a sector, the period is
+ *  rounded up to its ticks so the sectors never add up to more than
+ *  the revolution. Slower than the slowest clock, or a period too
+ *  short to split, just stretches. With frame set the frame just
+ *  composed is handed over together with its timing, so the two are
+ *  always swapped in at the same capture.
+ *
+ *  Modifies: gNextClock, gNextOcr, gNextRem, gNextRest, gNextFlags,
+ *            gNextSlotOcr, gTimingReady, gFrameReady
+ */
+void update_timing(uint8_t frame)
+{
+    uint32_t period;
+    sector_t sectors;
+    uint8_t shift;
+    uint8_t i;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        period = ((uint32_t)gRevOverflows << 16) + gRevTicks;
+        sectors = (frame || gFrameReady) ? gBackSectors : gFrontSectors;
+    }
+
+    for (i = 0; i < sizeof(gSectorShifts) - 1; i++)
+    {
+        shift = pgm_read_byte(&gSectorShifts[i]);
+        if (((period + (1UL << shift) - 1) >> shift) < 256UL * sectors)
+            break;
+    }
+    shift = pgm_read_byte(&gSectorShifts[i]);
+    period = (period + (1UL << shift) - 1) >> shift;
+
+    uint8_t flags = i ? TRACE_SLOW : 0;
+    uint16_t ticks = period / sectors;
+    sector_t rem = period % sectors;
+    if (ticks > 255 || ticks < 2)
+    {
+        ticks = 255;
+        rem = 0;
+        flags |= TRACE_STRETCH;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        gNextClock = SECTOR_CLOCK_8 + i;
+        gNextOcr = ticks - 1;
+        gNextRem = rem;
+        gNextRest = sectors - rem;
+        gNextFlags = flags;
+
+        /* Cut the sector into BCM slots, what is left over goes on the last */
+        uint8_t left = ticks;
+        for (uint8_t b = 0; b < BCM_BITS - 1; b++)
+        {
+            uint8_t len = ticks * (1 << b) / BCM_WEIGHTS;
+            gNextSlotOcr[b] = len - 1;
+            left -= len;
+        }
+        gNextSlotOcr[BCM_BITS - 1] = left - 1;
+
+        gTimingReady = 1;
+        if (frame)
+            gFrameReady = 1;
+    }
+}
+
+
+/*
+ * Function:    draw_background
+ * ----------------------------
+ *  Decodes the run length background out of flash into a frame. Each
+ *  run is a palette index and a length packed in a byte, or two for a
+ *  long run, see backgrounds.h, and the colors come from the palette
+ *  of the background. Run lengths are in BACKGROUND_RESOLUTION sectors,
+ *  the end of each run is scaled to RESOLUTION so the runs tile the
+ *  whole revolution. The animation turns it by gAnimOffset and moves
+ *  its colors on, and only the sectors below limit are drawn, for a
+ *  wipe.
+ *
+ *  Modifies: frame
+ */
+void draw_background(uint8_t *frame, uint8_t base, uint8_t background,
+                     sector_t limit)
+{
+    const Background *bg = &gBackgrounds[background];
+    const uint8_t *run = &gBackgroundRuns[pgm_read_byte(&bg->runs)];
+    const color_t *palette = &gBackgroundPalette[pgm_read_byte(&bg->palette)];
+    uint8_t planes[BCM_BITS];
+    uint16_t end = 0;
+    sector_t i = 0;
+    sector_t pos = gAnimOffset;
+
+    while (end < BACKGROUND_RESOLUTION)
+    {
+        uint8_t code = pgm_read_byte(run++);
+        uint8_t length = code & BG_LENGTH_MASK;
+
+        if (!length)
+            length = pgm_read_byte(run++);
+        color_planes(anim_color(pgm_read_word(&palette[code >> BG_INDEX_SHIFT])),
+                     base, planes);
+        end += length;
+        sector_t stop = (uint32_t)end * RESOLUTION / BACKGROUND_RESOLUTION;
+        while (i < stop && i < RESOLUTION)
+        {
+            if (pos < limit)
+                draw_sector(frame, pos, planes);
+            i++;
+            if (++pos >= RESOLUTION)
+                pos = 0;
+        }
+    }
+}
+
+
+/*
+ * Function:    init_layers
+ * ------------------------
+ *  Adds the display layers, the hour marks if they are built in and
+ *  the hands. The hour hand has the highest priority so it wins when
+ *  the hands overlap.
+ *
+ *  Modifies: gLayers, gHourHand.layer, gMinuteHand.layer,
+ *            gSecondHand.layer
+ */
+void init_layers(void)
+{
+#if HOUR_MARKS
+    Layer *marks = layer_add(MARK_PRIORITY, LAYER_OVER, 1);
+    marks->count = 12;
+    marks->step = SECTORS_PER_HOUR;
+    layer_color(marks, MARK_COLOR);
+#endif
+    gSecondHand.layer = layer_add(SECOND_PRIORITY, LAYER_OVER,
+                                  SECOND_HAND_WIDTH);
+    gMinuteHand.layer = layer_add(MINUTE_PRIORITY, LAYER_OVER,
+                                  MINUTE_HAND_WIDTH);
+    gHourHand.layer = layer_add(HOUR_PRIORITY, LAYER_OVER, HOUR_HAND_WIDTH);
+
+    gCalMarks = layer_add(CAL_PRIORITY, LAYER_ADD, 1);
+    gCalMarks->count = 4;
+    gCalMarks->step = RESOLUTION / 4;
+}
+
+
+/*
+ * Function:    compose_frame
+ * --------------------------
+ *  Builds the PORTD value for every slot of a revolution. The
+ *  background is decoded out of flash, with the next one over it as
+ *  far as a wipe has got, or the whole display is the flash color.
+ *  The layers are drawn over that. The non LED bits of PORTD (the hall
+ *  pullup) are carried into every entry so the ISR can write the whole
+ *  port.
+ *
+ *  Modifies: frame, gAnimShift
+ */
+void compose_frame(uint8_t *frame)
+{
+    uint8_t base = PORTD & ~(WHITE);
+
+    if (gAnimFlashing)
+    {
+        uint8_t planes[BCM_BITS];
+
+        color_planes(gAnimFlash, base, planes);
+        for (sector_t i = 0; i < RESOLUTION; i++)
+            draw_sector(frame, i, planes);
+    }
+    else
+    {
+        if (gAnimShift >= NUM_BACKGROUNDS)
+            gAnimShift -= NUM_BACKGROUNDS;
+        uint8_t background = gBackground + gAnimShift;
+        if (background >= NUM_BACKGROUNDS)
+            background -= NUM_BACKGROUNDS;
+
+        draw_background(frame, base, background, RESOLUTION);
+        if (gAnimWipe)
+            draw_background(frame, base, background + 1 < NUM_BACKGROUNDS ?
+                            background + 1 : 0, gAnimWipe);
+    }
+    layers_draw(frame, base);
 }
 
 
 /*
  * Function:    set_color
  * ----------------------
- *  Sets the color of the LEDs.  First turn off all the bits, and
- *  then turn on the color.
+ *  Sets the color of the LEDs in a single write of PORTD. The sector
+ *  ISR rewrites gSectorPort every slot, so it has to change along with
+ *  PORTD.
  *
- *  Modifies: PORTD
+ *  Modifies: PORTD, gSectorPort
  */
 void set_color(uint8_t color)
 {
-    PORTD &= ~(WHITE);
-    PORTD |= color;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        uint8_t port = (PORTD & ~(WHITE)) | color;
+
+        PORTD = port;
+        gSectorPort = port;
+    }
 }
 
 
@@ -345,9 +917,10 @@ void set_color(uint8_t color)
  * Function:    init_ESC
  * ---------------------
  *  Initializes the ESC by sending the correct PWM signals. First
- *  sets up TIMER 2 for fast PWM non-inverted mode and then sends
- *  a pusle of 500 microseconds to arm the device. Wait 7 seconds,
- *  and then send pulse of 1.2 milliseconds.
+ *  sets up TIMER 2 for fast PWM non-inverted mode and then starts the
+ *  governor sending the 500 microsecond arming pulse. Returns straight
+ *  away, the governor task cycles the LED colors while the ESC arms
+ *  and then spins the platter up, see governor.c.
  *
  *      | WGM21 | WGM20 | Mode of Operation
  *  ----------------------------------------
@@ -392,142 +965,806 @@ void set_color(uint8_t color)
  *    1  |   1  |   1  | 1024 prescaler
  *  ---------------------------------------
  *
- *  Modifies: TCCR2, LED color
+ *  Modifies: TCCR2, OCR2, gModeFlag
  */
 void init_ESC(void)
 {
     TCCR2 = (1 << WGM21) | (1 << WGM20) | (1 << COM21);
     TCCR2 |= (1 << CS22) | (1 << CS21) | (1 << CS20);
 
-    set_duty_cycle(500);
+    gModeFlag = 1;                  /* LEDs show the arming, not the display */
+    gov_init();
+}
+
+
+/*
+ * Function:    parse_uint
+ * -----------------------
+ *  Reads a decimal number of at most max. Returns a pointer past it,
+ *  or NULL if there is no number or it is too big.
+ *
+ *  Modifies: value
+ */
+const char *parse_uint(const char *str, uint16_t max, uint16_t *value)
+{
+    uint16_t n = 0;
+
+    if (*str < '0' || *str > '9')
+        return NULL;
+    while (*str >= '0' && *str <= '9')
+    {
+        n = n * 10 + (*str++ - '0');
+        if (n > max)
+            return NULL;
+    }
+    *value = n;
+    return str;
+}
+
 
-    for (uint8_t i = 0; i < 7; i++)
+/*
+ * Function:    set_time
+ * ---------------------
+ *  Handles T hh:mm:ss. The software clock is set and the time is
+ *  written to the DS1307, which restarts its second from here.
+ *
+ *  Modifies: software clock, hand values
+ *  Calls: rtc_set
+ */
+uint8_t set_time(const char *args)
+{
+    uint16_t hours, minutes, seconds;
+
+    if (!(args = parse_uint(args, 23, &hours)) || *args++ != ':' ||
+        !(args = parse_uint(args, 59, &minutes)) || *args++ != ':' ||
+        !(args = parse_uint(args, 59, &seconds)) || *args)
+        return 0;
+
+    rtc_set(hours, minutes, seconds);
+    update_hands();
+    return 1;
+}
+
+
+/*
+ * Function:    set_hand_color
+ * ---------------------------
+ *  Handles C h|m|s n and saves the color in EEPROM memory, the same as
+ *  the button handlers do.
+ *
+ *  Modifies: hand color
+ *  Calls: settings_changed
+ */
+uint8_t set_hand_color(const char *args)
+{
+    Hand *hand;
+    uint16_t color;
+
+    switch (*args++)
     {
-        set_color(gCycleColor[i]);
-        _delay_ms(1000);
+    case 'h': hand = &gHourHand;   break;
+    case 'm': hand = &gMinuteHand; break;
+    case 's': hand = &gSecondHand; break;
+    default: return 0;
     }
+    if (*args++ != ' ' ||
+        !(args = parse_uint(args, NUM_COLORS - 1, &color)) || *args)
+        return 0;
+
+    hand->color = color;
+    settings_changed();
+    return 1;
+}
+
+
+/*
+ * Function:    send_state
+ * -----------------------
+ *  Answers G with the time and the settings.
+ */
+void send_state(void)
+{
+    RTCDate date;
+    uint8_t time[3];
 
-    set_color(OFF);
-    set_duty_cycle(1200);
+    rtc_get(&date);
+    time[0] = date.hours;
+    time[1] = date.minutes;
+    time[2] = date.seconds;
+
+    uart_puts("T ");
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        if (time[i] < 10)
+            uart_write('0');
+        uart_put_uint(time[i]);
+        uart_write(i < 2 ? ':' : ' ');
+    }
+    uart_puts("C ");
+    uart_put_uint(gHourHand.color);
+    uart_write(' ');
+    uart_put_uint(gMinuteHand.color);
+    uart_write(' ');
+    uart_put_uint(gSecondHand.color);
+    uart_puts(" B ");
+    uart_put_uint(gBackground);
+    uart_puts(" A ");
+    uart_put_uint(gAnimation);
+    uart_puts(" P ");
+    uart_put_uint(gPhase);
+    uart_puts(" L ");
+    uart_put_uint(gLatency);
+    uart_puts("\r\n");
 }
 
 
 /*
- * Function:    read_time
+ * Function:    send_telemetry
+ * ---------------------------
+ *  Sends the last revolution period, how many sector ISRs it took, the
+ *  ESC pulse width, the governor state and how far the CPU clock is
+ *  off the DS1307. Runs once a second from the telemetry task while it
+ *  is on.
+ */
+void send_telemetry(void)
+{
+    uint16_t period;
+    sector_t slots;
+    int16_t ppm = rtc_ppm();
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        period = gRevPeriod;
+        slots = gRevSlots;
+    }
+
+    uart_puts("R ");
+    uart_put_uint(period);
+    uart_write(' ');
+    uart_put_uint(slots);
+    uart_write(' ');
+    uart_put_uint(gGovPulse);
+    uart_write(' ');
+    uart_put_uint(gGovState);
+    uart_write(' ');
+    if (ppm < 0)
+    {
+        uart_write('-');
+        ppm = -ppm;
+    }
+    uart_put_uint(ppm);
+    uart_puts("\r\n");
+}
+
+
+/*
+ * Function:    handle_command
+ * ---------------------------
+ *  Runs one serial command line, see constants.h for the commands.
+ */
+void handle_command(const char *line)
+{
+    uint8_t ok = 0;
+    uint16_t value;
+    const char *args = line + 2;
+
+    if (line[0] && line[1] != ' ' && line[1] != '\0')
+    {
+        uart_puts("ERR\r\n");
+        return;
+    }
+
+    switch (line[0])
+    {
+    case 'T':
+        ok = line[1] && set_time(args);
+        break;
+    case 'C':
+        ok = line[1] && set_hand_color(args);
+        break;
+    case 'B':
+        if (line[1] && (args = parse_uint(args, NUM_BACKGROUNDS - 1, &value))
+            && !*args)
+        {
+            gBackground = value;
+            layers_changed();
+            settings_changed();
+            ok = 1;
+        }
+        break;
+    case 'A':
+        if (line[1] && (args = parse_uint(args, NUM_ANIMATIONS - 1, &value))
+            && !*args)
+        {
+            gAnimation = value;
+            anim_start(gAnimation);
+            settings_changed();
+            ok = 1;
+        }
+        break;
+    case 'P':
+        if (line[1] && (args = parse_uint(args, RESOLUTION - 1, &value))
+            && !*args)
+        {
+            gPhase = value;
+            settings_changed();
+            ok = 1;
+        }
+        break;
+    case 'L':
+        if (line[1] && (args = parse_uint(args, LATENCY_MAX_US, &value))
+            && !*args)
+        {
+            gLatency = value;
+            settings_changed();
+            ok = 1;
+        }
+        break;
+    case 'S':
+        if (line[1] && (args = parse_uint(args, 255, &value)) && !*args)
+            ok = gov_set_target(value);
+        break;
+    case 'R':
+        if (line[1] && (args = parse_uint(args, 1, &value)) && !*args)
+        {
+            if (value)
+                sched_start(gTelemetryTask, 0);
+            else
+                sched_stop(gTelemetryTask);
+            ok = 1;
+        }
+        break;
+    case 'G':
+        if (!line[1])
+        {
+            send_state();
+            return;
+        }
+        break;
+#ifdef TRACE
+    case 'D':
+        if (!line[1])
+        {
+            trace_dump();
+            sched_start(gTraceTask, 0);
+            return;
+        }
+        if ((args = parse_uint(args, 1, &value)) && !*args && value)
+        {
+            trace_arm();
+            sched_stop(gTraceTask);
+            ok = 1;
+        }
+        break;
+#endif
+#ifdef STATS
+    case 'I':
+        if (!line[1])
+        {
+            stats_dump();
+            sched_start(gStatsTask, 0);
+            return;
+        }
+        break;
+#endif
+    }
+    uart_puts(ok ? "OK\r\n" : "ERR\r\n");
+}
+
+
+/*
+ * Function:    poll_commands
+ * --------------------------
+ *  Collects received bytes into a line and runs it at the end of the
+ *  line. Never waits, whatever has not arrived yet is picked up on the
+ *  next pass of the main loop. A line too long for gCommand is answered
+ *  with ERR.
+ *
+ *  Modifies: gCommand, gCommandLen
+ */
+void poll_commands(void)
+{
+    uint8_t data;
+
+    while (uart_read(&data))
+    {
+        if (data == '\r' || data == '\n')
+        {
+            if (gCommandLen > COMMAND_SIZE - 1)
+                uart_puts("ERR\r\n");
+            else if (gCommandLen)
+            {
+                gCommand[gCommandLen] = '\0';
+                handle_command(gCommand);
+            }
+            gCommandLen = 0;
+        }
+        else if (gCommandLen < COMMAND_SIZE)
+            gCommand[gCommandLen++] = data;
+    }
+}
+
+
+/*
+ * Function:    handle_button
+ * --------------------------
+ *  Runs the handler for a button event in the current mode. A press
+ *  always runs it, a long press and the repeats after it only for the
+ *  buttons in gButtonRepeats.
+ */
+void handle_button(uint8_t event)
+{
+    uint8_t button = event & ~BUTTON_TYPE;
+    void (*handler)(void) = gButtonHandlers[gMode][button];
+
+    if ((event & BUTTON_TYPE) != BUTTON_PRESS &&
+        !(gButtonRepeats[gMode] & (1 << button)))
+        return;
+
+    if (handler != NULL)
+        handler();
+}
+
+
+/*
+ * Function:    settings_changed
+ * -----------------------------
+ *  Saves the background and hand colors once they have stopped
+ *  changing for SETTINGS_SAVE_TICKS, so stepping through colors only
+ *  wears the EEPROM once.
+ */
+void settings_changed(void)
+{
+    sched_start(gSaveTask, SETTINGS_SAVE_TICKS);
+}
+
+
+/*
+ * Function:    load_settings
+ * --------------------------
+ *  Reads the background and hand colors saved in EEPROM memory. Each
+ *  one falls back to its default if there is no good record or it is
+ *  out of range for this build, so a fresh EEPROM never indexes past
+ *  gCycleColor or gBackgrounds.
+ *
+ *  Modifies: gBackground, gHourHand.color, gMinuteHand.color,
+ *            gSecondHand.color
+ */
+void load_settings(void)
+{
+    Settings settings;
+
+    if (!settings_load(&settings))
+    {
+        settings.background = DEFAULT_BACKGROUND;
+        settings.hour_color = DEFAULT_HOUR_COLOR;
+        settings.minute_color = DEFAULT_MINUTE_COLOR;
+        settings.second_color = DEFAULT_SECOND_COLOR;
+        settings.animation = DEFAULT_ANIMATION;
+        settings.phase = DEFAULT_PHASE;
+        settings.latency = DEFAULT_LATENCY;
+    }
+
+    gBackground = settings.background < NUM_BACKGROUNDS ?
+                  settings.background : DEFAULT_BACKGROUND;
+    gHourHand.color = settings.hour_color < NUM_COLORS ?
+                      settings.hour_color : DEFAULT_HOUR_COLOR;
+    gMinuteHand.color = settings.minute_color < NUM_COLORS ?
+                        settings.minute_color : DEFAULT_MINUTE_COLOR;
+    gSecondHand.color = settings.second_color < NUM_COLORS ?
+                        settings.second_color : DEFAULT_SECOND_COLOR;
+    gAnimation = settings.animation < NUM_ANIMATIONS ?
+                 settings.animation : DEFAULT_ANIMATION;
+    gPhase = settings.phase < RESOLUTION ? settings.phase : DEFAULT_PHASE;
+    gLatency = settings.latency <= LATENCY_MAX_US ?
+               settings.latency : DEFAULT_LATENCY;
+}
+
+
+/*
+ * Function:    task_save
  * ----------------------
- *  Reads the time from the DS1307 and sets the hand values.
- *  The data read off must be converted from Binary coded
- *  data to decimal.
+ *  One shot task, starts saving the settings to EEPROM memory. If the
+ *  last save is still being written it tries again on the next tick.
+ */
+void task_save(void)
+{
+    Settings settings;
+
+    settings.background = gBackground;
+    settings.hour_color = gHourHand.color;
+    settings.minute_color = gMinuteHand.color;
+    settings.second_color = gSecondHand.color;
+    settings.animation = gAnimation;
+    settings.phase = gPhase;
+    settings.latency = gLatency;
+
+    if (!settings_save(&settings))
+        sched_start(gSaveTask, 1);
+}
+
+
+/*
+ * Function:    task_rtc
+ * ---------------------
+ *  The time is kept by the software clock, this only goes to the
+ *  DS1307 when it is due, see rtc_poll.
  *
- *  Modifies: gSecondHand.value, gMinuteHand.value, gHourHand.value
+ *  Modifies: software clock sync state
+ *  Calls: rtc_poll
  */
-void read_time(void)
+void task_rtc(void)
 {
-    i2c_start(DS1307_WRITE);
-    i2c_write(DS1307_SECOND_ADDR);
-    i2c_stop();
+    rtc_poll();
+}
 
-    i2c_start(DS1307_READ);
-    gDate.seconds = bcd2bin(i2c_read_ack());
-    gDate.minutes = bcd2bin(i2c_read_ack());
-    gDate.hours = bcd2bin(i2c_read_ack());
-    gDate.weekday = bcd2bin(i2c_read_ack());
-    gDate.date = bcd2bin(i2c_read_ack());
-    gDate.month = bcd2bin(i2c_read_ack());
-    gDate.year = bcd2bin(i2c_read_nack());
-    i2c_stop();
 
-    gSecondHand.value = gDate.seconds;
-    gMinuteHand.value = gDate.minutes;
-    gHourHand.value = gDate.hours;
+/*
+ * Function:    task_display
+ * -------------------------
+ *  Moves the hands and, if anything on the display changed, composes
+ *  the next frame. It is swapped in at the next revolution.
+ *
+ *  Modifies: hand values, second hand sweep, hand layers, gBackFrame,
+ *            gFrameReady, gLayersChanged
+ */
+void task_display(void)
+{
+    update_hands();
+    update_rotation();
+    update_resolution();
+    layer_color(gCalMarks, gMode == CALIBRATE_MODE ? CAL_MARK_COLOR : RGB_OFF);
+    sweep_second_hand();
+    calculate_hour_position();
+    calculate_minute_position();
+    calculate_second_position();
+    anim_update(gRotations);
+
+#if CHIME
+    if (!gMinuteHand.value && !gSecondHand.value &&
+        gChimeHour != gHourHand.value)
+    {
+        gChimeHour = gHourHand.value;
+        anim_chime(gChimeHour % 12 ? gChimeHour % 12 : 12);
+    }
+#endif
+
+    if (gLayersChanged && !gFrameReady)
+    {
+        gLayersChanged = 0;
+        compose_frame(gBackFrame);
+        gBackSectors = RESOLUTION / gSectorDiv;
+        update_timing(1);
+    }
+    else
+        update_timing(0);
 }
 
 
 /*
- * Function:    update_ds1307
+ * Function:    task_input
+ * -----------------------
+ *  Runs the serial commands and the button events that have come in.
+ *  Button events are debounced and queued by the timer tick, the ones
+ *  that come while the ESC arms are dropped.
+ */
+void task_input(void)
+{
+    uint8_t event;
+
+    poll_commands();
+    while ((event = button_event()) != BUTTON_NONE)
+    {
+        if (gGovState != GOV_ARMING)
+            handle_button(event);
+    }
+}
+
+
+/*
+ * Function:    task_telemetry
+ * ---------------------------
+ *  Periodic task, started and stopped by the R command.
+ */
+void task_telemetry(void)
+{
+    send_telemetry();
+}
+
+
+#ifdef TRACE
+/*
+ * Function:    task_trace
+ * -----------------------
+ *  Periodic task, started by the D command. Sends the trace a line a
+ *  tick and stops once it is all out.
+ */
+void task_trace(void)
+{
+    if (!trace_send())
+        sched_stop(gTraceTask);
+}
+#endif
+
+
+#ifdef STATS
+/*
+ * Function:    task_stats
+ * -----------------------
+ *  Periodic task, started by the I command. Sends the stats a line a
+ *  tick and stops once they are all out.
+ */
+void task_stats(void)
+{
+    if (!stats_send())
+        sched_stop(gStatsTask);
+}
+#endif
+
+
+/*
+ * Function:    task_governor
  * --------------------------
- *  Writes the most recent values of readtime and the changed
- *  values read when setting the time to the ds1307. First it
- *  disables the oscillator.
+ *  Periodic task, every tick. Hands the last revolution to the speed
+ *  governor. While the ESC arms it cycles the LEDs through the colors,
+ *  one a second, and gives them back to the display once it is armed.
  *
- *  Modifies: DS1307
+ *  Modifies: ESC pulse, gModeFlag, LED color
  */
-void update_ds1307(void)
+void task_governor(void)
 {
-    i2c_start(DS1307_WRITE);
-    i2c_write(DS1307_SECOND_ADDR);
-    i2c_write(DS1307_OSC_STOP);
-    i2c_stop();
+    uint16_t period;
+    uint8_t arming = gGovState == GOV_ARMING;
 
-    i2c_start(DS1307_WRITE);
-    i2c_write(DS1307_SECOND_ADDR);
-    i2c_write(bin2bcd(gSecondHand.value));
-    i2c_write(bin2bcd(gMinuteHand.value));
-    i2c_write(bin2bcd(gHourHand.value));
-    i2c_write(bin2bcd(gDate.weekday));
-    i2c_write(bin2bcd(gDate.date));
-    i2c_write(bin2bcd(gDate.month));
-    i2c_write(bin2bcd(gDate.year));
-    i2c_stop();
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        period = gRevPeriod;
+    }
+    gov_update(period, gRotations);
+
+    if (gGovState == GOV_ARMING)
+        set_color(color_plane(pgm_read_word(&gCycleColor[gGovTicks / TICK_HZ]),
+                              BCM_BITS - 1));
+    else if (arming)
+    {
+        set_color(OFF);
+        gModeFlag = 0;
+    }
+}
+
+
+/*
+ * Function:    ISR for TIMER2_OVF vector
+ * --------------------------------------
+ *  The timer tick, TICK_HZ times a second. TIMER 2 is running the ESC
+ *  PWM and overflows at the end of every pulse period.
+ *
+ *  Modifies: OCR2, software clock, button state, mode blink, scheduler
+ *            ticks
+ */
+ISR(TIMER2_OVF_vect)
+{
+    gov_pwm_tick();
+    rtc_tick();
+    buttons_tick();
+    blink_tick();
+    sched_tick();
+}
+
+
+/*
+ * Function:    ISR for SECTOR_ADVANCE vector
+ * ------------------------------------------
+ *  The body of the sector ISR, jumped to from TIMER0_COMP_vect once the
+ *  LEDs are written. It is a signal handler of its own so GCC saves
+ *  what it uses and returns with reti, the __vector prefix only keeps
+ *  GCC from warning that the name is misspelled. Loads the PORTD value
+ *  for the next slot, then picks the length of the next slot. At the
+ *  start of each section the extra tick is handed out whenever the
+ *  remainder has built up a whole one, it goes on the sections last
+ *  slot.
+ *
+ *  Modifies: gPlatterPos, gSectorPort, gSlot, OCR0, gSectorAcc,
+ *            gSectorCarry
+ */
+#define SECTOR_ADVANCE_vect     __vector_sector_advance
+
+ISR(SECTOR_ADVANCE_vect)
+{
+    STATS_SECTOR_LATENCY();
+    gPlatterPos++;
+    if (gPlatterPos < gFrameLast && !gModeFlag)
+        gSectorPort = gFrontFrame[gPlatterPos + 1];
+
+    uint8_t slot = gSlot + 1;
+    if (slot >= BCM_BITS)
+    {
+        slot = 0;
+        if (gSectorAcc >= gSectorRest)
+        {
+            gSectorAcc -= gSectorRest;
+            gSectorCarry = 1;
+        }
+        else
+        {
+            gSectorAcc += gSectorRem;
+            gSectorCarry = 0;
+        }
+    }
+    gSlot = slot;
+
+    if (slot == BCM_BITS - 1)
+        OCR0 = gSlotOcr[slot] + gSectorCarry;
+    else
+        OCR0 = gSlotOcr[slot];
 }
 
 
 /*
  * Function:    ISR for TIMER0_COMP vector
  * ---------------------------------------
- *  Sets the LED colors for the current section. This interrupt
- *  should trigger everytime the platter has advanced a section.
- *  The time this takes should be relatively consistent and is
- *  adjusted when we complete 1 revolution
+ *  Sets the LED colors for the current slot. This interrupt should
+ *  trigger everytime the platter has advanced a slot, BCM_BITS times a
+ *  section. It is naked so that no prologue GCC picks comes before the
+ *  write. The PORTD value was loaded into gSectorPort by the last
+ *  slot, so the entry is the same five instructions every time:
+ *
+ *      push r24                    2 cycles
+ *      lds  r24, gSectorPort       2
+ *      out  PORTD, r24             1   PORTD changes here
+ *      pop  r24                    2
+ *      jmp  SECTOR_ADVANCE_vect    3
+ *
+ *  None of them touch SREG. With the 4 cycle interrupt response and the
+ *  3 cycle jmp in the vector table the LEDs change 12 cycles after the
+ *  compare match is taken, on every slot. Only the 1 to 3 cycles to
+ *  finish the instruction that was running, or another ISR already
+ *  running, can move it. make bench checks the write is at the same
+ *  cycle on every path.
  *
- *  Modifies: gPlatterPos, LED color
+ *  Modifies: PORTD
  */
+#ifdef SIM
 ISR(TIMER0_COMP_vect)
 {
-    gPlatterPos++;
-    if (gPlatterPos < RESOLUTION && !gModeFlag)
-    {
-        set_color(pgm_read_byte(&(gBackgrounds[gBackground][gPlatterPos])));
+    PORTD = gSectorPort;
+    SECTOR_ADVANCE_vect();
+}
+#else
+ISR(TIMER0_COMP_vect, ISR_NAKED)
+{
+    asm volatile (
+        "push r24"              "\n\t"
+        "lds r24, gSectorPort"  "\n\t"
+        "out %[port], r24"      "\n\t"
+        "pop r24"               "\n\t"
+        "jmp __vector_sector_advance"
+        :: [port] "I" (_SFR_IO_ADDR(PORTD)));
+}
+#endif
 
-        if (gPlatterPos == gSecondHand.pos1 || gPlatterPos == gSecondHand.pos2)
-            set_color(gCycleColor[gSecondHand.color]);
-        if (gPlatterPos == gMinuteHand.pos1 || gPlatterPos == gMinuteHand.pos2)
-            set_color(gCycleColor[gMinuteHand.color]);
-        if (gPlatterPos == gHourHand.pos1 || gPlatterPos == gHourHand.pos2)
-            set_color(gCycleColor[gHourHand.color]);
-    }
+
+/*
+ * Function:    ISR for TIMER1_OVF vector
+ * --------------------------------------
+ *  Counts TIMER 1 overflows since the last hall capture, so a platter
+ *  too slow to fit a revolution in 16 bits is still timed. Saturates at
+ *  REV_OVERFLOWS_MAX, anything slower has stopped.
+ *
+ *  Modifies: gT1Overflows
+ */
+ISR(TIMER1_OVF_vect)
+{
+    if (gT1Overflows < REV_OVERFLOWS_MAX)
+        gT1Overflows++;
 }
 
 
 /*
- * Function:    ISR for INT0 vector
- * --------------------------------
- *  Triggers when the hall effect sensor is activated. This interrupt
- *  disables the TIMER 0 interrupt so things are not stepping on each
- *  other. It resets the TIMER 0 counter to 0 and then re-enables the
- *  interrupt. Also, it adjusts the length of OCR0 to help ensure that
- *  full resolution sections are triggered.
- *
- *  Modifies: TIMSK, TCNT0, OCR0, gPlatterPos
- */
-ISR(INT0_vect)
-{
-    TIMSK &= ~(1 << OCIE0);
-    TCNT0 = 0;
-    TIMSK |= (1 << OCIE0);
-    /* Help adjust for extreme cases of slowness, like starting up */
-    if (OCR0 < 160 || OCR0 > 200)
-        OCR0 = 179;
-
-    /* Too many sector triggers, slow down TIMER 0 */
-    if (gPlatterPos > 180)
-        OCR0++;
-    /* Too few sector triggers, speed up TIMER 0 */
-    else if (gPlatterPos < 180)
-        OCR0--;
+ * Function:    ISR for TIMER1_CAPT vector
+ * ---------------------------------------
+ *  Triggers when the hall effect sensor is activated. TIMER 1 has
+ *  latched the time of the edge in ICR1, so the revolution period is
+ *  the difference from the last capture, measured to a single tick.
+ *  TIMER 0 is restarted from the time already spent since the edge,
+ *  which takes the latency of getting here out of the first sector.
+ *  If the main loop has finished composing a new frame it is swapped
+ *  in here, before sector 0 is written from it, so a frame is never
+ *  changed part way through a revolution, and the timing update_timing
+ *  left is taken up. No loops, divides or 32 bit sums, so make bench
+ *  can bound it.
+ *
+ *  Modifies: PORTD, TCNT0, TCCR0, OCR0, TIFR, gPlatterPos, gSlot, gRevPeriod,
+ *            gRevTicks, gRevOverflows, gRevSlots, gRotations,
+ *            gSectorClock, gSectorOcr, gSectorRem, gSectorRest,
+ *            gSectorFlags, gSectorAcc, gSlotOcr, gTimingReady,
+ *            gFrontFrame, gBackFrame, gFrontSectors, gFrameLast,
+ *            gSectorPort
+ */
+ISR(TIMER1_CAPT_vect)
+{
+    uint16_t capture = ICR1;
+    uint8_t late = TCNT1 - capture;
+
+    /* In TIMER 0 ticks, they are 3, 5 or 7 bits slower on a slow clock */
+    uint8_t start = late;
+    if (gSectorClock >= SECTOR_CLOCK_64)
+        start >>= 3;
+    if (gSectorClock >= SECTOR_CLOCK_256)
+        start >>= 2;
+    if (gSectorClock >= SECTOR_CLOCK_1024)
+        start >>= 2;
+    TCNT0 = start;
+    HAL_FLAG_CLEAR(TIFR, 1 << OCF0);              /* Drop a stale sector compare */
+    STATS_CAPTURE(gPlatterPos, gFrameLast, late);
+    gRevSlots = gPlatterPos;
     gPlatterPos = 0;
-}
+    TRACE_CAPTURE(gRevSlots, gFrameLast, late, gSectorOcr);
+
+    if (gFrameReady)
+    {
+        uint8_t *frame = gFrontFrame;
+        gFrontFrame = gBackFrame;
+        gBackFrame = frame;
+        gFrontSectors = gBackSectors;
+        gFrameLast = gFrontSectors * BCM_BITS - 1;
+        gFrameReady = 0;
+        TRACE_FLAG(TRACE_SWAP);
+    }
+    if (!gModeFlag)
+        PORTD = gFrontFrame[0];
 
+    /* An overflow that has not been serviced yet belongs to this period */
+    if ((TIFR & (1 << TOV1)) && capture < 0x8000)
+    {
+        HAL_FLAG_CLEAR(TIFR, 1 << TOV1);
+        gT1Overflows++;
+    }
+
+    /* A capture below the last already has one overflow in its ticks */
+    uint8_t overflows = gT1Overflows;
+    if (capture < gLastCapture && overflows)
+        overflows--;
+    gRevTicks = capture - gLastCapture;
+    gRevOverflows = overflows;
+    gRevPeriod = overflows ? 0xFFFF : gRevTicks;
+    gLastCapture = capture;
+    gT1Overflows = 0;
+    gRotations++;
+
+    /* Written out rather than looped so make bench can bound it */
+    if (gTimingReady)
+    {
+        gSectorClock = gNextClock;
+        gSectorOcr = gNextOcr;
+        gSectorRem = gNextRem;
+        gSectorRest = gNextRest;
+        gSectorFlags = gNextFlags;
+        gSlotOcr[0] = gNextSlotOcr[0];
+#if BCM_BITS > 1
+        gSlotOcr[1] = gNextSlotOcr[1];
+#endif
+#if BCM_BITS > 2
+        gSlotOcr[2] = gNextSlotOcr[2];
+#endif
+#if BCM_BITS > 3
+        gSlotOcr[3] = gNextSlotOcr[3];
+#endif
+        gTimingReady = 0;
+    }
+    TCCR0 = (1 << WGM01) | gSectorClock;
+    gSectorAcc = gSectorRem;
+    gSectorCarry = 0;
+    TRACE_FLAG(gSectorFlags);
+    STATS_PERIOD(gRevPeriod, gSectorOcr);
+    TRACE_PERIOD(gRevPeriod, gSectorOcr);
+
+    gSlot = 0;
+    OCR0 = gSlotOcr[0];
+
+    if (!gModeFlag)
+        gSectorPort = gFrontFrame[1];
+}
 
 
 int main(void)
@@ -557,64 +1794,55 @@ int main(void)
 #else
 
     i2c_init();
-    uint8_t button_const[NUM_BUTTONS] = {BUTTON1, BUTTON2, BUTTON3};
-    uint8_t buttons[NUM_BUTTONS] = {0};
+    uart_init();
 
-    /* Read the saved background and hand colors from EEPROM memory */
-    gBackground       = eeprom_read_byte((const uint8_t *)EEPROM_BACKGROUND_ADDR);
-    gHourHand.color   = eeprom_read_byte((const uint8_t *)EEPROM_HOUR_ADDR);
-    gMinuteHand.color = eeprom_read_byte((const uint8_t *)EEPROM_MINUTE_ADDR);
-    gSecondHand.color = eeprom_read_byte((const uint8_t *)EEPROM_SECOND_ADDR);
+    load_settings();
 
     DDRD  |= (1 << RED_LED) | (1 << BLUE_LED) |    /* Set LED pins as outputs */
              (1 << GREEN_LED) | (1 << PWM);
 
     init_ESC();
-    PORTD |= (1 << PD2);                         /* PD2(INT0) pullup resistor */
-    MCUCR  = (1 << ISC01);                               /* Falling edge INT0 */
-    GICR   = (1 << INT0);                   /* Enable external interrupt INT0 */
+    PORTD |= (1 << HALL_PIN);                 /* PD6(ICP1) pullup resistor */
+    init_layers();
+    anim_start(gAnimation);
+    calculate_hour_position();
+    calculate_minute_position();
+    calculate_second_position();
+    compose_frame(gFrontFrame);              /* Never display an empty frame */
+    gSectorPort = gFrontFrame[1];
+
+    TCCR1A = 0;                                       /* TIMER 1 normal mode */
+    TCCR1B = (1 << ICNC1) | (1 << CS11);  /* Falling edge capture, noise    */
+                                          /* canceler, 8 prescaler          */
+    TIMSK |= (1 << TICIE1) | (1 << TOIE1);    /* Enable capture and overflow */
+
+    TIMSK |= (1 << TOIE2);                  /* TIMER 2 overflow is the tick */
 
     TCCR0  = (1 << WGM01) | (1 << CS01);     /* TIMER 0 CTC mode, 8 prescaler */
     TIMSK |= (1 << OCIE0);                        /* Enable TIMER 0 interrupt */
-    OCR0   = 179;                                   /* Initial OCR for 62 RPS */
+    OCR0   = gSlotOcr[0];                   /* Initial OCR for TARGET_RPS */
+    STATS_RESET();
     sei();                                           /* Enable all interrupts */
+    rtc_init();
 
     PORTA  = 0x00;
-    PORTA |= (1 << BUTTON1) |               /* Button inputs internal pullups */
-             (1 << BUTTON2) |
-             (1 << BUTTON3);
+    buttons_init();                          /* Button inputs internal pullups */
+
+    sched_start(sched_add(task_rtc, RTC_TASK_TICKS), 0);
+    sched_start(sched_add(task_display, 1), 0);
+    sched_start(sched_add(task_input, 1), 0);
+    gTelemetryTask = sched_add(task_telemetry, TICK_HZ);
+    gSaveTask = sched_add(task_save, 0);
+#ifdef TRACE
+    gTraceTask = sched_add(task_trace, 1);
+#endif
+#ifdef STATS
+    gStatsTask = sched_add(task_stats, 1);
+#endif
+    sched_start(sched_add(task_governor, 1), 0);
 
     while (1)
-    {
-        read_time();
-        calculate_hour_position();
-        calculate_minute_position();
-        calculate_second_position();
-
-        /* check the buttons states, with some basic debounce */
-        for (int i = 0; i < NUM_BUTTONS; i++)
-        {
-            if (PINA & (1 << button_const[i]))
-            {
-                if (!buttons[i])
-                {
-                    buttons[i] = 1;
-                }
-            }
-            else
-            {
-                if (buttons[i])
-                {
-                    if (gButtonHandlers[gMode][i] != NULL)
-                    {
-                        gButtonHandlers[gMode][i]();
-                    }
-                    buttons[i] = 0;
-                }
-            }
-        }
-        _delay_ms(100);
-    }
+        sched_run();
 
 #endif
 
@@ -1,13 +1,172 @@
 #ifndef CONSTANTS_H
 #define CONSTANTS_H
 
+#include <stdint.h>
+
 #define BCDtoDEC(x) ((x) - (6 * (x >> 4)))
 #define DECtoBCD(x) ((x) + (6 * (x / 10)))
 
-#define NUM_MODES       5
-#define NUM_COLORS      8
+#define NUM_MODES       6
+#define CALIBRATE_MODE  5
+
+
+/*
+ * Angular resolution, sectors per revolution. Set from the Makefile,
+ * eg: make RESOLUTION=360 sim, the frames only fit in the ATmega16 up
+ * to 180, see FRAME_RAM
+ */
+#ifndef RESOLUTION
 #define RESOLUTION      180
-#define NUM_BACKGROUNDS 10
+#endif
+#define SECTORS_PER_HOUR (RESOLUTION / 12)
+#define SECTORS_PER_SECOND (RESOLUTION / 60)
+
+/*
+ * The second hand always sweeps a sector at a time through each second.
+ * With MINUTE_SWEEP the minute hand creeps on through the minute too.
+ * Set from the Makefile, make MINUTE_SWEEP=0 steps it once a minute.
+ */
+#ifndef MINUTE_SWEEP
+#define MINUTE_SWEEP    1
+#endif
+
+/* Hand positions are exact integer math only if this holds */
+#if (RESOLUTION % 60) != 0
+#error "RESOLUTION must be a multiple of 60"
+#endif
+
+/*
+ * Color depth, bits of intensity per LED channel. Above 1 each sector
+ * is split into BCM_BITS binary code modulation slots weighted 1, 2,
+ * 4.. and the frame holds a PORTD byte for every slot. Set from the
+ * Makefile, eg: make BCM_BITS=2 sim, at 180 sectors only 1 fits in
+ * the ATmega16, see FRAME_RAM
+ */
+#ifndef BCM_BITS
+#define BCM_BITS        1
+#endif
+#define FRAME_SIZE      (RESOLUTION * BCM_BITS)
+#define BCM_WEIGHTS     ((1 << BCM_BITS) - 1)
+
+#if BCM_BITS < 1 || BCM_BITS > 4
+#error "BCM_BITS must be 1 to 4"
+#endif
+
+/*
+ * Two frames of FRAME_SIZE bytes have to fit in the 1K of SRAM beside
+ * about 500 bytes of other static data (UART rings, layers, tasks, the
+ * I2C queue, button handlers and the scalars) and the stack. That
+ * leaves room for 180 sectors at BCM_BITS 1 and no more. This stops a
+ * frame that can not fit before it is built, make all checks the real
+ * figure with avr-size. The host simulator has the memory to run
+ * larger frames, so deeper color can still be tried there.
+ */
+#define FRAME_RAM       384
+#if !defined(SIM) && (2 * FRAME_SIZE) > FRAME_RAM
+#error "RESOLUTION * BCM_BITS too large, the frame buffers will not fit in SRAM"
+#endif
+
+/* Wide enough to count every slot of a frame */
+#if FRAME_SIZE > 255
+typedef uint16_t sector_t;
+#else
+typedef uint8_t sector_t;
+#endif
+
+
+/*
+ * Sector ISR budget. TARGET_RPS is the platter speed the display has to
+ * hold. SECTOR_ISR_CYCLES is the worst case cost of TIMER0_COMP_vect,
+ * entry to reti, and it may use at most SECTOR_ISR_LOAD percent of each
+ * sector so the main loop still gets to compose frames. The figure is
+ * counted by hand from the ISR at BCM_BITS 2, 17 cycles of entry and
+ * the naked write, 18 of prologue, 21 of epilogue and reti and 55 of
+ * body, with room to spare. make bench counts the real figure from the
+ * ELF and fails if it is over this.
+ */
+#ifndef TARGET_RPS
+#define TARGET_RPS          62
+#endif
+#define SECTOR_ISR_CYCLES   120
+#define SECTOR_ISR_LOAD     50
+#define SECTOR_CYCLES       (F_CPU / (TARGET_RPS * 1L * RESOLUTION))
+#define SECTOR_TICKS        (SECTOR_CYCLES / 8)     /* TIMER 0 at F_CPU / 8 */
+#define SLOT_CYCLES_MIN     (SECTOR_CYCLES / BCM_WEIGHTS)
+
+#if (SECTOR_ISR_CYCLES * BCM_BITS * 100) > (SECTOR_CYCLES * SECTOR_ISR_LOAD)
+#error "Sector ISR does not fit in its cycle budget at this RESOLUTION and TARGET_RPS"
+#endif
+
+/* The shortest BCM slot has to outlast the ISR that starts it */
+#if SECTOR_ISR_CYCLES >= SLOT_CYCLES_MIN
+#error "Shortest BCM slot is shorter than the sector ISR, lower BCM_BITS"
+#endif
+
+/* A sector at TARGET_RPS has to fit in the 8 bit TIMER 0 */
+#if SECTOR_TICKS > 256
+#error "Sectors too long for TIMER 0 at this RESOLUTION and TARGET_RPS"
+#endif
+
+/*
+ * Speed adaptive resolution. The frame is always drawn in RESOLUTION
+ * sectors, but shown in RESOLUTION / divisor of them, each as wide as
+ * divisor drawn ones. A platter faster than TARGET_RPS gets the
+ * smallest divisor whose sectors, in TIMER 1 ticks, still hold the
+ * sector ISR budget above, so the top speed uses all the headroom
+ * there is. A slower one keeps every sector and TIMER 0 drops to a
+ * slower clock instead, down to F_CPU / 1024. Going back up to more
+ * sectors needs SECTOR_TICKS_MIN with 1/8 to spare, so a speed on the
+ * edge does not switch back and forth.
+ */
+#define SECTOR_TICKS_LOAD   ((SECTOR_ISR_CYCLES * BCM_BITS * 100L / \
+                              SECTOR_ISR_LOAD + 7) / 8)
+#define SECTOR_TICKS_SLOT   (SECTOR_ISR_CYCLES * BCM_WEIGHTS / 8 + 1)
+#define SECTOR_TICKS_MIN    (SECTOR_TICKS_LOAD > SECTOR_TICKS_SLOT ? \
+                             SECTOR_TICKS_LOAD : SECTOR_TICKS_SLOT)
+#define SECTOR_DIVISORS     {1, 2, 3, 4, 5, 6, 10, 12, 15}   /* All divide 60 */
+
+/* TIMER 1 overflows in a revolution before it counts as stopped, ~2 s */
+#define REV_OVERFLOWS_MAX   64
+
+/* TIMER 0 clock selects, CS02..CS00, F_CPU / 8, 64, 256 and 1024 */
+#define SECTOR_CLOCK_8      2
+#define SECTOR_CLOCK_64     3
+#define SECTOR_CLOCK_256    4
+#define SECTOR_CLOCK_1024   5
+
+/*
+ * Display layers, see layers.h. Higher priorities draw on top. Set
+ * from the Makefile, make HOUR_MARKS=1 adds a mark at every hour under
+ * the hands.
+ */
+#ifndef HOUR_MARKS
+#define HOUR_MARKS          0
+#endif
+#define MARK_PRIORITY       0
+#define SECOND_PRIORITY     1
+#define MINUTE_PRIORITY     2
+#define HOUR_PRIORITY       3
+#define CAL_PRIORITY        4
+#define MARK_COLOR          RGB_WHITE
+#define CAL_MARK_COLOR      RGB_WHITE
+#define HOUR_HAND_WIDTH     2       /* Sectors */
+#define MINUTE_HAND_WIDTH   2
+#define SECOND_HAND_WIDTH   2
+
+/* Background animations, see anim.h. CHIME=0 leaves out the hourly chime */
+#ifndef CHIME
+#define CHIME               1
+#endif
+
+/*
+ * Display phase. The frame is turned back against the spin by the
+ * phase, in sectors, to bring 12 o'clock round to the top wherever the
+ * hall sensor sits, and by however far the platter turns in the
+ * latency, the delay from the hall edge to the LEDs changing. Both are
+ * set in CALIBRATE mode or over the serial line and saved in EEPROM.
+ */
+#define LATENCY_MAX_US      1000
+#define LATENCY_STEP_US     10
 
 /* LED color definitions */
 #define RED_LED         PD3
@@ -25,6 +184,33 @@
 #define YELLOW          (1 << RED_LED) | (1 << GREEN_LED)
 #define WHITE           (1 << RED_LED) | (1 << BLUE_LED) | (1 << GREEN_LED)
 
+/*
+ * Display colors are 4 bits per channel, 0xRGB, independent of the
+ * pins. The top BCM_BITS of each channel are what gets shown.
+ */
+typedef uint16_t color_t;
+
+#define RGB(r, g, b)    (((r) << 8) | ((g) << 4) | (b))
+#define RGB_OFF         RGB(0, 0, 0)
+#define RGB_RED         RGB(15, 0, 0)
+#define RGB_GREEN       RGB(0, 15, 0)
+#define RGB_BLUE        RGB(0, 0, 15)
+#define RGB_CYAN        RGB(0, 15, 15)
+#define RGB_PURPLE      RGB(15, 0, 15)
+#define RGB_YELLOW      RGB(15, 15, 0)
+#define RGB_WHITE       RGB(15, 15, 15)
+
+/* The 8 on/off colors, plus some shades when there is depth for them */
+#if BCM_BITS > 1
+#define NUM_COLORS      14
+#else
+#define NUM_COLORS      8
+#endif
+
+
+/* Hall effect sensor, wired to the TIMER 1 input capture pin */
+#define HALL_PIN        PD6
+
 
 /* Button definitions */
 #define NUM_BUTTONS     3
@@ -33,6 +219,47 @@
 #define BUTTON3         PA6
 
 
+/*
+ * Timer tick, the TIMER 2 overflow. TIMER 2 runs the ESC PWM at
+ * F_CPU / 1024, so it overflows about 61 times a second.
+ */
+#define TICK_HZ             (F_CPU / 1024 / 256)
+#define MS_TO_TICKS(ms)     ((ms) * TICK_HZ / 1000)
+
+/* Button debounce, long press and repeat, in ticks */
+#define BUTTON_INTEGRATOR   MS_TO_TICKS(50)
+#define BUTTON_LONG_TICKS   MS_TO_TICKS(600)
+#define BUTTON_REPEAT_TICKS MS_TO_TICKS(150)
+
+/* Scheduler task timing, in ticks */
+#define RTC_TASK_TICKS      MS_TO_TICKS(250)
+#define RTC_QUIET_RUNS      8       /* 2 s without a 1 Hz edge */
+#define SETTINGS_SAVE_TICKS MS_TO_TICKS(2000)
+
+/* Mode change blinks, in ticks */
+#define BLINK_SHORT         MS_TO_TICKS(100)
+#define BLINK_LONG          MS_TO_TICKS(250)
+
+
+/*
+ * ESC and speed governor, see governor.c. Pulse widths are in
+ * microseconds, speeds in 1/16 revolutions per second.
+ */
+#define ESC_ARM_US          500     /* Held while the ESC arms */
+#define ESC_ARM_TICKS       MS_TO_TICKS(7000)
+#define GOV_MIN_US          1000    /* Motor stopped */
+#define GOV_MAX_US          1600
+#define GOV_START_US        1100    /* Open loop ramp starts here */
+#define GOV_RAMP_US         2       /* Open loop ramp, per tick */
+#define GOV_RAMP            4       /* Set speed ramp, per revolution */
+#define GOV_LAG             32      /* Ramp waits while this far behind */
+#define GOV_LOCK            8       /* Locked once this close */
+#define GOV_KP_DIV          8       /* Proportional, 1/8 us per 1/16 RPS */
+#define GOV_KI              4       /* Integral, 1/256 us per 1/16 RPS */
+#define GOV_RPS_MIN         31      /* Slowest a revolution fits TIMER 1 */
+#define GOV_STALL_TICKS     MS_TO_TICKS(100)
+
+
 /* DS1307 definitions */
 #define DS1307_WRITE        0xD0
 #define DS1307_READ         0xD1
@@ -45,13 +272,65 @@
 #define DS1307_YEAR_ADDR    0x06
 #define DS1307_CONTROL_ADDR 0x07
 #define DS1307_OSC_STOP     0x80
+#define DS1307_SQW_1HZ      0x10    /* SQWE set, RS1:RS0 = 00 */
+#define DS1307_SQW_PIN      PB2     /* SQW/OUT wired to INT2 */
+
+/*
+ * Software clock, see rtc.c. It counts the CPU cycles of each tick and
+ * the DS1307 1 Hz edge trims how many make a second, within
+ * RTC_TRIM_MAX of F_CPU. An edge further out than that is not used to
+ * trim, RTC_TRIM_GAIN is how gently it is pulled in.
+ */
+#define RTC_TICK_CYCLES     (1024L * 256)   /* TIMER 2 overflow */
+#define RTC_TRIM_MAX        (F_CPU / 2000)  /* 500 ppm */
+#define RTC_TRIM_GAIN       16
+
+
+/*
+ * Serial commands, one per line at UART_BAUD 8N1. Every command is
+ * answered with OK or ERR, G answers with the state instead.
+ *  T hh:mm:ss  -- set the time, 24 hour, and write it to the DS1307
+ *  C h|m|s n   -- set the hour, minute or second hand color, 0..NUM_COLORS-1
+ *  B n         -- set the background, 0..NUM_BACKGROUNDS-1
+ *  A n         -- set the background animation, 0..NUM_ANIMATIONS-1,
+ *                 0 for none
+ *  P n         -- set the display phase, 0..RESOLUTION-1 sectors
+ *  L n         -- set the latency, 0..LATENCY_MAX_US us
+ *  G           -- get, answers T hh:mm:ss C h m s B n A n P n L n
+ *  S n         -- set the platter speed, GOV_RPS_MIN..TARGET_RPS RPS
+ *  R 0|1       -- stop or start telemetry, once a second:
+ *                 R <period in TIMER 1 ticks> <sector ISRs last revolution>
+ *                   <ESC pulse in us> <governor state, see governor.h>
+ *                   <CPU clock against the DS1307 in ppm>
+ *  D           -- with make TRACE=1, dump the revolution trace, see
+ *                 trace.h, TRACE_DEPTH lines then OK:
+ *                 D <period> <sector ISRs> <OCR before> <OCR after>
+ *                   <capture latency> <flags>
+ *  D 1         -- with make TRACE=1, arm the trace trigger
+ *  I           -- with make STATS=1, send the display timing stats and
+ *                 the scheduler task maxima, see stats.h, and clear
+ *                 them, then OK. TIMER 1 ticks unless given:
+ *                 I P <revolutions> <period min> <period max> <mean>
+ *                 I S <sector ISRs last revolution> <min> <max>
+ *                   <short revolutions> <long revolutions>
+ *                 I O <last STATS_HISTORY sector OCRs, oldest first>
+ *                 I L <capture latency> <sector latency in TIMER 0
+ *                   ticks at F_CPU / 8> </ 64> </ 256> </ 1024>
+ *                   <main loop work last> <max>
+ *                 I T <task id> <late max in scheduler ticks>
+ *                   <run max>, one line for each task
+ */
+#define COMMAND_SIZE    16
 
 
-/* EEPROM address definitions */
-#define EEPROM_BACKGROUND_ADDR  0x00
-#define EEPROM_HOUR_ADDR        0x01
-#define EEPROM_MINUTE_ADDR      0x02
-#define EEPROM_SECOND_ADDR      0x03
+/* Settings used when EEPROM has none saved, colors index gCycleColor */
+#define DEFAULT_BACKGROUND      0
+#define DEFAULT_HOUR_COLOR      1       /* Red */
+#define DEFAULT_MINUTE_COLOR    5       /* Green */
+#define DEFAULT_SECOND_COLOR    3       /* Blue */
+#define DEFAULT_ANIMATION       0       /* None */
+#define DEFAULT_PHASE           0
+#define DEFAULT_LATENCY         0
 
 
 /*
@@ -0,0 +1,230 @@
+/*
+ * File:    governor.c
+ * Description: Closed loop platter speed governor. Arms the ESC, spins
+ *              the platter up and then holds it at the target speed by
+ *              trimming the ESC pulse width from the hall sensor period.
+ *
+ * The ESC pulse can only be set in PWM_TICK_WIDTH steps of OCR2, far too
+ * coarse to hold a speed with. The pulse width is kept in microseconds
+ * and the timer tick dithers OCR2 between the two steps either side of
+ * it, so the average over a few pulses is right to the microsecond. The
+ * platter is much too heavy to follow a single pulse.
+ *
+ * The controller is a PI on the speed error, run once per revolution
+ * with the integral kept in 1/256 microseconds. Below about 31 RPS a
+ * revolution does not fit in TIMER 1 and the speed can not be measured,
+ * there the pulse just ramps up open loop until the hall sensor gives a
+ * period. From there the set speed ramps up to the target, but only
+ * while the platter keeps within GOV_LAG of it, so spin up is as fast as
+ * the motor can follow without the integral winding up behind it.
+ */
+
+#include <avr/io.h>
+#include <util/atomic.h>
+
+#include "governor.h"
+
+uint8_t gGovState = GOV_ARMING;
+uint16_t gGovTicks = 0;             /* Ticks spent arming */
+uint16_t gGovPulse = ESC_ARM_US;
+uint16_t gGovTarget = TARGET_RPS * 16;
+uint16_t gGovSet = 0;               /* Ramped set speed, 0 before a period */
+int32_t gGovIntegral = 0;
+uint8_t gGovRevs = 0;
+uint8_t gGovQuiet = 0;              /* Ticks since the last revolution */
+
+/* OCR2 for the whole PWM ticks of the pulse, and the remainder to dither */
+volatile uint8_t gGovOcr = 0;
+volatile uint8_t gGovFrac = 0;
+uint8_t gGovDither = 0;
+
+
+/*
+ * Function:    set_duty_cycle
+ * ---------------------------
+ *  Sets the ESC pulse width in microseconds. It is split into whole
+ *  PWM ticks and a remainder that gov_pwm_tick dithers in. A fast PWM
+ *  pulse is OCR2 + 1 ticks long, so OCR2 is one less than the ticks. A
+ *  width under one tick gets the shortest pulse there is, one tick.
+ *
+ *  Modifies: gGovPulse, gGovOcr, gGovFrac
+ */
+void set_duty_cycle(uint16_t width)
+{
+    uint8_t ticks = width / PWM_TICK_WIDTH;
+
+    gGovPulse = width;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        gGovOcr = ticks ? ticks - 1 : 0;
+        gGovFrac = ticks ? width % PWM_TICK_WIDTH : 0;
+    }
+}
+
+
+/*
+ * Function:    gov_init
+ * ---------------------
+ *  Starts arming the ESC. TIMER 2 has to be set up for the PWM already,
+ *  the first pulse goes out before the tick is running.
+ *
+ *  Modifies: gGovState, gGovTicks, OCR2
+ */
+void gov_init(void)
+{
+    gGovState = GOV_ARMING;
+    gGovTicks = 0;
+    set_duty_cycle(ESC_ARM_US);
+    OCR2 = gGovOcr;
+}
+
+
+/*
+ * Function:    gov_set_target
+ * ---------------------------
+ *  Sets the speed to hold, GOV_RPS_MIN..TARGET_RPS revolutions a
+ *  second. The set speed ramps over to it. Returns 0 if out of range.
+ *
+ *  Modifies: gGovTarget, gGovState
+ */
+uint8_t gov_set_target(uint8_t rps)
+{
+    if (rps < GOV_RPS_MIN || rps > TARGET_RPS)
+        return 0;
+
+    gGovTarget = rps * 16;
+    if (gGovState == GOV_LOCKED)
+        gGovState = GOV_SPINUP;
+    return 1;
+}
+
+
+/*
+ * Function:    ramp_set_speed
+ * ---------------------------
+ *  Moves the set speed GOV_RAMP closer to the target, unless the
+ *  platter has fallen more than GOV_LAG behind it. A platter running
+ *  ahead of the ramp pulls the set speed along with it.
+ *
+ *  Modifies: gGovSet, gGovState
+ */
+void ramp_set_speed(uint16_t speed)
+{
+    if (!gGovSet)
+        gGovSet = speed;
+
+    if (gGovSet < gGovTarget)
+    {
+        if (speed > gGovSet)
+            gGovSet = speed;
+        else if (speed + GOV_LAG >= gGovSet)
+            gGovSet += GOV_RAMP;
+        if (gGovSet > gGovTarget)
+            gGovSet = gGovTarget;
+    }
+    else if (gGovSet > gGovTarget)
+    {
+        if (speed < gGovSet)
+            gGovSet = speed;
+        else if (speed <= gGovSet + GOV_LAG)
+            gGovSet -= GOV_RAMP;
+        if (gGovSet < gGovTarget)
+            gGovSet = gGovTarget;
+    }
+}
+
+
+/*
+ * Function:    gov_update
+ * -----------------------
+ *  Runs the governor, once a tick from the main loop. Takes the last
+ *  revolution period in TIMER 1 ticks and the count of revolutions so
+ *  far, the controller only acts when that has moved on.
+ *
+ *  Modifies: gGovState, gGovTicks, gGovSet, gGovIntegral, gGovRevs,
+ *            gGovQuiet, the ESC pulse
+ */
+void gov_update(uint16_t period, uint8_t revolutions)
+{
+    uint8_t fresh = revolutions != gGovRevs;
+
+    if (gGovState == GOV_ARMING)
+    {
+        if (++gGovTicks < ESC_ARM_TICKS)
+            return;
+        gGovState = GOV_SPINUP;
+        gGovSet = 0;
+        gGovIntegral = (int32_t)GOV_START_US << 8;
+        set_duty_cycle(GOV_START_US);
+        return;
+    }
+
+    gGovRevs = revolutions;
+    if (fresh)
+        gGovQuiet = 0;
+    else if (gGovQuiet < GOV_STALL_TICKS)
+        gGovQuiet++;
+
+    if (gGovQuiet >= GOV_STALL_TICKS || period == 0xFFFF || !period)
+    {
+        gGovState = GOV_SPINUP;
+        gGovSet = 0;
+        gGovIntegral += (int32_t)GOV_RAMP_US << 8;
+        if (gGovIntegral > (int32_t)GOV_MAX_US << 8)
+            gGovIntegral = (int32_t)GOV_MAX_US << 8;
+        set_duty_cycle(gGovIntegral >> 8);
+        return;
+    }
+    if (!fresh)
+        return;
+
+    uint16_t speed = GOV_SPEED(period);
+
+    if (gGovState == GOV_SPINUP)
+        ramp_set_speed(speed);
+
+    int16_t error = gGovSet - speed;
+
+    if (gGovState == GOV_SPINUP && gGovSet == gGovTarget &&
+        error < GOV_LOCK && error > -GOV_LOCK)
+        gGovState = GOV_LOCKED;
+    else if (gGovState == GOV_LOCKED && (error > GOV_LAG || error < -GOV_LAG))
+        gGovState = GOV_SPINUP;
+
+    gGovIntegral += (int32_t)error * GOV_KI;
+    if (gGovIntegral > (int32_t)GOV_MAX_US << 8)
+        gGovIntegral = (int32_t)GOV_MAX_US << 8;
+    if (gGovIntegral < (int32_t)GOV_MIN_US << 8)
+        gGovIntegral = (int32_t)GOV_MIN_US << 8;
+
+    int16_t pulse = (gGovIntegral >> 8) + error / GOV_KP_DIV;
+    if (pulse > GOV_MAX_US)
+        pulse = GOV_MAX_US;
+    if (pulse < GOV_MIN_US)
+        pulse = GOV_MIN_US;
+    set_duty_cycle(pulse);
+}
+
+
+/*
+ * Function:    gov_pwm_tick
+ * -------------------------
+ *  Picks OCR2 for the next pulse, one step up whenever the remainder
+ *  has added up to a whole PWM tick. Called from the timer tick, which
+ *  is the end of a pulse period, and OCR2 only takes effect at the top
+ *  of the count so the pulse going out is never cut.
+ *
+ *  Modifies: gGovDither, OCR2
+ */
+void gov_pwm_tick(void)
+{
+    uint8_t ocr = gGovOcr;
+
+    gGovDither += gGovFrac;
+    if (gGovDither >= PWM_TICK_WIDTH)
+    {
+        gGovDither -= PWM_TICK_WIDTH;
+        ocr++;
+    }
+    OCR2 = ocr;
+}
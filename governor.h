@@ -0,0 +1,34 @@
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+#include <stdint.h>
+
+#include "constants.h"
+
+/*
+ * Platter speed governor. Speeds are in 1/16 revolutions per second,
+ * pulse widths in microseconds.
+ *
+ * ARMING  -- ESC_ARM_US for ESC_ARM_TICKS, what the ESC needs to arm
+ * SPINUP  -- the set speed ramps to the target as fast as the platter
+ *            keeps up with it
+ * LOCKED  -- holding the target
+ */
+#define GOV_ARMING      0
+#define GOV_SPINUP      1
+#define GOV_LOCKED      2
+
+/* Revolution period in TIMER 1 ticks to speed */
+#define GOV_SPEED(period)   ((uint16_t)(F_CPU / 8 * 16 / (period)))
+
+extern uint8_t gGovState;
+extern uint16_t gGovTicks;
+extern uint16_t gGovPulse;
+
+void set_duty_cycle(uint16_t width);
+void gov_init(void);
+uint8_t gov_set_target(uint8_t rps);
+void gov_update(uint16_t period, uint8_t revolutions);
+void gov_pwm_tick(void);
+
+#endif
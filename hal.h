@@ -0,0 +1,42 @@
+#ifndef HAL_H
+#define HAL_H
+
+/*
+ * Thin hardware abstraction layer.
+ *
+ * On the AVR the registers come from <avr/io.h> and are used directly.
+ * The host simulator (make sim) supplies its own <avr/...> headers from
+ * sim/include where every register is a plain variable that sim/sim.c
+ * reads and updates around the code under test.
+ *
+ * That works for registers that are just storage. The few whose writes
+ * have side effects in hardware have to go through these macros so the
+ * simulator sees the write:
+ *
+ *  HAL_TWCR_WRITE  -- writing TWINT starts the next TWI bus action
+ *  HAL_FLAG_CLEAR  -- TIFR, GIFR flags are cleared by writing a 1
+ *  HAL_UDR_READ    -- reading UDR takes the byte and clears RXC
+ *  HAL_UDR_WRITE   -- writing UDR starts sending the byte
+ */
+
+#include <avr/io.h>
+
+#ifdef SIM
+
+#include "sim/sim.h"
+
+#define HAL_TWCR_WRITE(value)       sim_twcr_write(value)
+#define HAL_FLAG_CLEAR(reg, mask)   sim_flag_clear(&(reg), (mask))
+#define HAL_UDR_READ()              sim_udr_read()
+#define HAL_UDR_WRITE(value)        sim_udr_write(value)
+
+#else
+
+#define HAL_TWCR_WRITE(value)       (TWCR = (value))
+#define HAL_FLAG_CLEAR(reg, mask)   ((reg) = (mask))
+#define HAL_UDR_READ()              (UDR)
+#define HAL_UDR_WRITE(value)        (UDR = (value))
+
+#endif
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef HANDS_H
+#define HANDS_H
+
+#include <stdint.h>
+
+#include "constants.h"
+#include "layers.h"
+
+/*
+ * Clock hands, kept in clock.c. value is the hour, minute or second
+ * shown and the calculate_*_position routines turn it into where the
+ * hand's layer sits, place_hand centering the layer on the sector.
+ * The host check in sim/hands.c drives them through these too.
+ */
+typedef struct Hand
+{
+    uint8_t value;
+    uint8_t color;              /* gCycleColor index */
+    Layer *layer;
+} Hand;
+
+extern Hand gHourHand;
+extern Hand gMinuteHand;
+extern Hand gSecondHand;
+extern uint8_t gSweepSecond;
+
+void init_layers(void);
+void place_hand(Hand *hand, sector_t pos);
+void calculate_hour_position(void);
+void calculate_minute_position(void);
+void calculate_second_position(void);
+
+#endif
@@ -1,21 +1,41 @@
 /*
- * This library is from:
+ * The blocking functions in this library are from:
  * https://github.com/g4lvanix/I2C-master-lib
+ *
+ * The transaction queue below them drives the bus from TWI_vect so the
+ * caller never waits on TWINT. Do not mix the two while the queue is
+ * busy, they share the same hardware.
  */
 
 #ifndef  F_CPU
 #define F_CPU 16000000UL
 #endif
 
+#include <stddef.h>
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
 #include <util/twi.h>
 
+#include "hal.h"
 #include "i2c.h"
 
 #define F_SCL 100000UL // SCL frequency
 #define PRESCALER 1
 #define TWBR_VAL ((((F_CPU / F_SCL) / PRESCALER) - 16 ) / 2)
 
+// TWCR values used by the interrupt driven state machine
+#define TWCR_START  ((1<<TWINT) | (1<<TWSTA) | (1<<TWEN) | (1<<TWIE))
+#define TWCR_SEND   ((1<<TWINT) | (1<<TWEN) | (1<<TWIE))
+#define TWCR_ACK    ((1<<TWINT) | (1<<TWEN) | (1<<TWIE) | (1<<TWEA))
+#define TWCR_NACK   ((1<<TWINT) | (1<<TWEN) | (1<<TWIE))
+#define TWCR_STOP   ((1<<TWINT) | (1<<TWEN) | (1<<TWSTO))
+
+I2CTransaction *gI2CQueue[I2C_QUEUE_SIZE];
+volatile uint8_t gI2CHead = 0;
+volatile uint8_t gI2CCount = 0;
+uint8_t gI2CIndex = 0;
+
 void i2c_init(void)
 {
     TWBR = (uint8_t)TWBR_VAL;
@@ -24,9 +44,9 @@ void i2c_init(void)
 uint8_t i2c_start(uint8_t address)
 {
     // reset TWI control register
-    TWCR = 0;
+    HAL_TWCR_WRITE(0);
     // transmit START condition
-    TWCR = (1<<TWINT) | (1<<TWSTA) | (1<<TWEN);
+    HAL_TWCR_WRITE((1<<TWINT) | (1<<TWSTA) | (1<<TWEN));
     // wait for end of transmission
     while( !(TWCR & (1<<TWINT)) );
 
@@ -36,7 +56,7 @@ uint8_t i2c_start(uint8_t address)
     // load slave address into data register
     TWDR = address;
     // start transmission of address
-    TWCR = (1<<TWINT) | (1<<TWEN);
+    HAL_TWCR_WRITE((1<<TWINT) | (1<<TWEN));
     // wait for end of transmission
     while( !(TWCR & (1<<TWINT)) );
 
@@ -52,7 +72,7 @@ uint8_t i2c_write(uint8_t data)
     // load data into data register
     TWDR = data;
     // start transmission of data
-    TWCR = (1<<TWINT) | (1<<TWEN);
+    HAL_TWCR_WRITE((1<<TWINT) | (1<<TWEN));
     // wait for end of transmission
     while( !(TWCR & (1<<TWINT)) );
 
@@ -65,7 +85,7 @@ uint8_t i2c_read_ack(void)
 {
 
     // start TWI module and acknowledge data after reception
-    TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWEA);
+    HAL_TWCR_WRITE((1<<TWINT) | (1<<TWEN) | (1<<TWEA));
     // wait for end of transmission
     while( !(TWCR & (1<<TWINT)) );
     // return received data from TWDR
@@ -76,7 +96,7 @@ uint8_t i2c_read_nack(void)
 {
 
     // start receiving without acknowledging reception
-    TWCR = (1<<TWINT) | (1<<TWEN);
+    HAL_TWCR_WRITE((1<<TWINT) | (1<<TWEN));
     // wait for end of transmission
     while( !(TWCR & (1<<TWINT)) );
     // return received data from TWDR
@@ -87,5 +107,154 @@ uint8_t i2c_read_nack(void)
 void i2c_stop(void)
 {
     // transmit STOP condition
-    TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWSTO);
+    HAL_TWCR_WRITE((1<<TWINT) | (1<<TWEN) | (1<<TWSTO));
+}
+
+
+/*
+ * Function:    i2c_submit
+ * -----------------------
+ *  Queues a transaction and starts the bus if it is idle. Returns
+ *  right away, the caller polls transaction->status or waits for the
+ *  callback. Returns 1 if the queue is full.
+ *
+ *  Modifies: gI2CQueue, gI2CCount, TWCR
+ */
+uint8_t i2c_submit(I2CTransaction *transaction)
+{
+    uint8_t ret = 0;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (gI2CCount >= I2C_QUEUE_SIZE)
+        {
+            ret = 1;
+        }
+        else
+        {
+            transaction->status = I2C_PENDING;
+            gI2CQueue[(gI2CHead + gI2CCount) % I2C_QUEUE_SIZE] = transaction;
+            gI2CCount++;
+            // bus was idle, kick it off
+            if (gI2CCount == 1)
+                HAL_TWCR_WRITE(TWCR_START);
+        }
+    }
+    return ret;
+}
+
+
+/*
+ * Function:    i2c_submit_pair
+ * ----------------------------
+ *  Queues two transactions to go on the bus back to back, or neither.
+ *  For a pair where the first alone would leave the device in a bad
+ *  state. Returns 1, queuing nothing, if there are not two free slots.
+ *
+ *  Modifies: gI2CQueue, gI2CCount, TWCR
+ *  Calls: i2c_submit
+ */
+uint8_t i2c_submit_pair(I2CTransaction *first, I2CTransaction *second)
+{
+    uint8_t ret = 1;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (gI2CCount <= I2C_QUEUE_SIZE - 2)
+        {
+            i2c_submit(first);
+            i2c_submit(second);
+            ret = 0;
+        }
+    }
+    return ret;
+}
+
+
+/*
+ * Function:    i2c_finish
+ * -----------------------
+ *  Ends the transaction at the head of the queue with a STOP and hands
+ *  back the result. If another transaction is waiting a START is
+ *  requested along with the STOP, the hardware sends them in order.
+ *
+ *  Modifies: gI2CHead, gI2CCount, TWCR
+ */
+void i2c_finish(uint8_t status)
+{
+    I2CTransaction *t = gI2CQueue[gI2CHead];
+
+    gI2CHead = (gI2CHead + 1) % I2C_QUEUE_SIZE;
+    gI2CCount--;
+    if (gI2CCount)
+        HAL_TWCR_WRITE(TWCR_STOP | (1<<TWSTA) | (1<<TWIE));
+    else
+        HAL_TWCR_WRITE(TWCR_STOP);
+
+    t->status = status;
+    if (t->callback != NULL)
+        t->callback(t);
+}
+
+
+/*
+ * Function:    ISR for TWI vector
+ * ---------------------------
+ *  Runs the transaction at the head of the queue one bus event at a
+ *  time: address, write bytes, repeated start, read bytes. Any NACK
+ *  or bus error ends the transaction with I2C_ERROR.
+ *
+ *  Modifies: TWCR, TWDR, gI2CIndex, read_buf of the transaction
+ */
+ISR(TWI_vect)
+{
+    I2CTransaction *t = gI2CQueue[gI2CHead];
+
+    switch (TW_STATUS)
+    {
+    case TW_START:
+        gI2CIndex = 0;
+        TWDR = t->address | (t->write_len ? I2C_WRITE : I2C_READ);
+        HAL_TWCR_WRITE(TWCR_SEND);
+        break;
+
+    case TW_REP_START:
+        gI2CIndex = 0;
+        TWDR = t->address | I2C_READ;
+        HAL_TWCR_WRITE(TWCR_SEND);
+        break;
+
+    case TW_MT_SLA_ACK:
+    case TW_MT_DATA_ACK:
+        if (gI2CIndex < t->write_len)
+        {
+            TWDR = t->write_buf[gI2CIndex++];
+            HAL_TWCR_WRITE(TWCR_SEND);
+        }
+        else if (t->read_len)
+            HAL_TWCR_WRITE(TWCR_START);
+        else
+            i2c_finish(I2C_DONE);
+        break;
+
+    case TW_MR_DATA_ACK:
+        t->read_buf[gI2CIndex++] = TWDR;
+        // fall through
+    case TW_MR_SLA_ACK:
+        // NACK the last byte so the slave lets go of the bus
+        if (gI2CIndex + 1 < t->read_len)
+            HAL_TWCR_WRITE(TWCR_ACK);
+        else
+            HAL_TWCR_WRITE(TWCR_NACK);
+        break;
+
+    case TW_MR_DATA_NACK:
+        t->read_buf[gI2CIndex++] = TWDR;
+        i2c_finish(I2C_DONE);
+        break;
+
+    default:
+        i2c_finish(I2C_ERROR);
+        break;
+    }
 }
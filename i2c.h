@@ -4,11 +4,39 @@
 #define I2C_READ 0x01
 #define I2C_WRITE 0x00
 
+/* Number of transactions that can be waiting on the bus at once */
+#define I2C_QUEUE_SIZE 4
+
+/* Transaction status values */
+#define I2C_DONE    0x00
+#define I2C_PENDING 0x01
+#define I2C_ERROR   0x02
+
+/*
+ * A queued bus transaction. The write buffer is sent first, then if
+ * there is anything to read a repeated start is issued and the read
+ * buffer is filled. Either length may be 0. The transaction and both
+ * buffers must stay valid until status leaves I2C_PENDING. The
+ * callback, if any, runs from the TWI interrupt.
+ */
+typedef struct I2CTransaction
+{
+    uint8_t address;            /* 8 bit bus address, R/W bit clear */
+    const uint8_t *write_buf;
+    uint8_t write_len;
+    uint8_t *read_buf;
+    uint8_t read_len;
+    void (*callback)(struct I2CTransaction *);
+    volatile uint8_t status;
+} I2CTransaction;
+
 void i2c_init(void);
 uint8_t i2c_start(uint8_t address);
 uint8_t i2c_write(uint8_t data);
 uint8_t i2c_read_ack(void);
 uint8_t i2c_read_nack(void);
 void i2c_stop(void);
+uint8_t i2c_submit(I2CTransaction *transaction);
+uint8_t i2c_submit_pair(I2CTransaction *first, I2CTransaction *second);
 
 #endif
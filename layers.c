@@ -0,0 +1,299 @@
+/*
+ * File:    layers.c
+ * Description: Display layers and the color to PORTD helpers the frame
+ *              is composed with, see layers.h.
+ */
+
+#include <stddef.h>
+#include <avr/io.h>
+
+#include "layers.h"
+
+Layer gLayers[MAX_LAYERS];
+uint8_t gLayerOrder[MAX_LAYERS];        /* gLayers indexes, lowest first */
+uint8_t gNumLayers = 0;
+uint8_t gLayersChanged = 1;
+sector_t gRotation = 0;                 /* Sectors on in the frame */
+uint8_t gSectorDiv = 1;                 /* Drawn sectors to a frame one */
+
+
+/*
+ * Function:    sector_slot
+ * ------------------------
+ *  Returns where the first slot of a sector is in the frame, turned on
+ *  by the rotation and divided down to the sectors the frame has.
+ */
+uint16_t sector_slot(sector_t sector)
+{
+    uint16_t turned = (uint16_t)sector + gRotation;
+
+    if (turned >= RESOLUTION)
+        turned -= RESOLUTION;
+    if (gSectorDiv > 1)
+        turned /= gSectorDiv;
+    return turned * BCM_BITS;
+}
+
+
+/*
+ * Function:    color_plane
+ * ------------------------
+ *  Returns the LED pins that are on in one BCM bit plane of a color.
+ *  Plane 0 is the least significant of the BCM_BITS shown, plane
+ *  BCM_BITS - 1 is the top bit of each channel.
+ */
+uint8_t color_plane(color_t color, uint8_t plane)
+{
+    uint8_t shift = 4 - BCM_BITS + plane;
+    uint8_t pins = OFF;
+
+    if (color & (1 << (8 + shift)))
+        pins |= (1 << RED_LED);
+    if (color & (1 << (4 + shift)))
+        pins |= (1 << GREEN_LED);
+    if (color & (1 << shift))
+        pins |= (1 << BLUE_LED);
+    return pins;
+}
+
+
+/*
+ * Function:    sector_color
+ * -------------------------
+ *  Reads back the color drawn in a sector, the opposite of
+ *  color_planes. Only the BCM_BITS shown of each channel are there.
+ */
+color_t sector_color(const uint8_t *frame, sector_t sector)
+{
+    color_t color = RGB_OFF;
+
+    frame += sector_slot(sector);
+    for (uint8_t b = 0; b < BCM_BITS; b++)
+    {
+        uint8_t shift = 4 - BCM_BITS + b;
+
+        if (frame[b] & (1 << RED_LED))
+            color |= 1 << (8 + shift);
+        if (frame[b] & (1 << GREEN_LED))
+            color |= 1 << (4 + shift);
+        if (frame[b] & (1 << BLUE_LED))
+            color |= 1 << shift;
+    }
+    return color;
+}
+
+
+/*
+ * Function:    add_colors
+ * -----------------------
+ *  Adds two colors channel by channel, each saturating at 15.
+ */
+color_t add_colors(color_t a, color_t b)
+{
+    color_t sum = RGB_OFF;
+
+    for (uint8_t shift = 0; shift < 12; shift += 4)
+    {
+        uint8_t channel = ((a >> shift) & 0x0F) + ((b >> shift) & 0x0F);
+        sum |= (color_t)(channel > 15 ? 15 : channel) << shift;
+    }
+    return sum;
+}
+
+
+/*
+ * Function:    draw_sector
+ * ------------------------
+ *  Writes a color into every slot of a sector.
+ *
+ *  Modifies: frame[sector_slot(sector) ..]
+ */
+void draw_sector(uint8_t *frame, sector_t sector, const uint8_t *planes)
+{
+    frame += sector_slot(sector);
+    for (uint8_t b = 0; b < BCM_BITS; b++)
+        frame[b] = planes[b];
+}
+
+
+/*
+ * Function:    color_planes
+ * -------------------------
+ *  Expands a color into the PORTD value for each slot.
+ *
+ *  Modifies: planes
+ */
+void color_planes(color_t color, uint8_t base, uint8_t *planes)
+{
+    for (uint8_t b = 0; b < BCM_BITS; b++)
+        planes[b] = base | color_plane(color, b);
+}
+
+
+/*
+ * Function:    layer_add
+ * ----------------------
+ *  Adds a single arc layer, off and at sector 0 until it is moved and
+ *  colored. Layers of the same priority draw in the order they were
+ *  added. Returns NULL if there is no room left.
+ *
+ *  Modifies: gLayers, gLayerOrder, gNumLayers, gLayersChanged
+ */
+Layer *layer_add(uint8_t priority, uint8_t blend, uint8_t width)
+{
+    if (gNumLayers >= MAX_LAYERS)
+        return NULL;
+
+    Layer *layer = &gLayers[gNumLayers];
+    layer->color = RGB_OFF;
+    layer->start = 0;
+    layer->step = 0;
+    layer->width = width;
+    layer->count = 1;
+    layer->priority = priority;
+    layer->blend = blend;
+
+    uint8_t i = gNumLayers;
+    while (i && gLayers[gLayerOrder[i - 1]].priority > priority)
+    {
+        gLayerOrder[i] = gLayerOrder[i - 1];
+        i--;
+    }
+    gLayerOrder[i] = gNumLayers++;
+    gLayersChanged = 1;
+    return layer;
+}
+
+
+/*
+ * Function:    layer_move
+ * -----------------------
+ *  Moves a layer to start at a sector.
+ *
+ *  Modifies: layer->start, gLayersChanged
+ */
+void layer_move(Layer *layer, sector_t start)
+{
+    if (layer->start != start)
+    {
+        layer->start = start;
+        gLayersChanged = 1;
+    }
+}
+
+
+/*
+ * Function:    layer_color
+ * ------------------------
+ *  Changes the color of a layer.
+ *
+ *  Modifies: layer->color, gLayersChanged
+ */
+void layer_color(Layer *layer, color_t color)
+{
+    if (layer->color != color)
+    {
+        layer->color = color;
+        gLayersChanged = 1;
+    }
+}
+
+
+/*
+ * Function:    layers_changed
+ * ---------------------------
+ *  Marks the frame to be composed again for a change that is not in
+ *  a layer, the background.
+ *
+ *  Modifies: gLayersChanged
+ */
+void layers_changed(void)
+{
+    gLayersChanged = 1;
+}
+
+
+/*
+ * Function:    layers_rotate
+ * --------------------------
+ *  Turns the whole display on by rotation sectors, 0..RESOLUTION-1,
+ *  from the next frame composed.
+ *
+ *  Modifies: gRotation, gLayersChanged
+ */
+void layers_rotate(sector_t rotation)
+{
+    if (gRotation != rotation)
+    {
+        gRotation = rotation;
+        gLayersChanged = 1;
+    }
+}
+
+
+/*
+ * Function:    layers_divide
+ * --------------------------
+ *  Shows the display in RESOLUTION / divisor sectors from the next
+ *  frame composed, divisor has to divide RESOLUTION.
+ *
+ *  Modifies: gSectorDiv, gLayersChanged
+ */
+void layers_divide(uint8_t divisor)
+{
+    if (gSectorDiv != divisor)
+    {
+        gSectorDiv = divisor;
+        gLayersChanged = 1;
+    }
+}
+
+
+/*
+ * Function:    layers_draw
+ * ------------------------
+ *  Draws every layer into a frame, lowest priority first. Arcs wrap
+ *  past the last sector to the first. An OVER layer expands its color
+ *  once, an ADD layer has to read back every sector it covers. Drawn
+ *  sectors that share a frame sector are drawn into it once, so an
+ *  ADD layer does not add to itself.
+ *
+ *  Modifies: frame
+ */
+void layers_draw(uint8_t *frame, uint8_t base)
+{
+    uint8_t planes[BCM_BITS];
+
+    for (uint8_t i = 0; i < gNumLayers; i++)
+    {
+        const Layer *layer = &gLayers[gLayerOrder[i]];
+        uint16_t start = layer->start;
+
+        color_planes(layer->color, base, planes);
+        for (uint8_t n = 0; n < layer->count; n++)
+        {
+            uint16_t sector = start;
+            uint16_t last = 0xFFFF;
+
+            for (uint8_t w = 0; w < layer->width; w++)
+            {
+                uint16_t slot = sector_slot(sector);
+
+                if (slot != last)
+                {
+                    if (layer->blend == LAYER_ADD)
+                        color_planes(add_colors(sector_color(frame, sector),
+                                                layer->color), base, planes);
+                    draw_sector(frame, sector, planes);
+                    last = slot;
+                }
+                if (++sector >= RESOLUTION)
+                    sector = 0;
+            }
+
+            start += layer->step;
+            if (start >= RESOLUTION)
+                start -= RESOLUTION;
+        }
+    }
+}
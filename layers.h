@@ -0,0 +1,60 @@
+#ifndef LAYERS_H
+#define LAYERS_H
+
+#include <stdint.h>
+
+#include "constants.h"
+
+/*
+ * Display layers, drawn over the background into the frame. A layer
+ * is an arc of width sectors from start, repeated count times step
+ * sectors apart, so one layer can be a hand or all the hour marks.
+ * Layers draw in priority order, the highest last and on top. A width
+ * of 0 hides a layer.
+ *
+ * Blend rules, how a layer combines with what is under it:
+ *  LAYER_OVER  -- replaces it
+ *  LAYER_ADD   -- adds to it, each channel saturating at full
+ *
+ * Layers only ever draw into a frame being composed, never from the
+ * sector ISR. Changing one through layer_move or layer_color marks the
+ * frame to be composed again, nothing is redrawn when nothing moved.
+ *
+ * Everything drawn, the background too, is turned by the rotation set
+ * with layers_rotate. It only changes where a sector lands in the
+ * frame, the sector ISR still plays the frame out from the hall edge.
+ * Likewise layers_divide sets how many drawn sectors share each sector
+ * of the frame, which is then only RESOLUTION / divisor sectors long.
+ */
+#define LAYER_OVER      0
+#define LAYER_ADD       1
+
+/* Most layers that can be added */
+#define MAX_LAYERS      8
+
+typedef struct Layer
+{
+    color_t color;
+    sector_t start;             /* First sector */
+    sector_t step;              /* Sectors between repeats */
+    uint8_t width;              /* Sectors, 0 hides it */
+    uint8_t count;              /* Repeats, 1 for a single arc */
+    uint8_t priority;           /* Higher draws over lower */
+    uint8_t blend;
+} Layer;
+
+extern uint8_t gLayersChanged;
+extern uint8_t gSectorDiv;
+
+uint8_t color_plane(color_t color, uint8_t plane);
+void color_planes(color_t color, uint8_t base, uint8_t *planes);
+void draw_sector(uint8_t *frame, sector_t sector, const uint8_t *planes);
+Layer *layer_add(uint8_t priority, uint8_t blend, uint8_t width);
+void layer_move(Layer *layer, sector_t start);
+void layer_color(Layer *layer, color_t color);
+void layers_changed(void);
+void layers_rotate(sector_t rotation);
+void layers_divide(uint8_t divisor);
+void layers_draw(uint8_t *frame, uint8_t base);
+
+#endif
@@ -0,0 +1,466 @@
+/*
+ * File:    rtc.c
+ * Description: Software real time clock kept by the timer tick and
+ *              disciplined by the DS1307, see rtc.h.
+ *
+ * Each tick adds RTC_TICK_CYCLES to gRTCFrac, the CPU cycles into the
+ * current second, and a second is gRTCSecond of them. The 16 MHz
+ * crystal is not the 32 kHz one the DS1307 keeps time with, so on each
+ * 1 Hz edge the phase of gRTCFrac is read, to a TIMER 2 count, and that
+ * is how far the software second was off. The second is moved to the
+ * edge and gRTCSecond trimmed by a part of the error, so it settles on
+ * the length of a DS1307 second as the CPU counts it. While the edges
+ * keep coming the tick waits one tick past the end of the second, and
+ * it is the edge that rolls it. If they stop the tick carries on alone
+ * at the trimmed rate.
+ */
+
+#include <stddef.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+#include "constants.h"
+#include "hal.h"
+#include "i2c.h"
+#include "rtc.h"
+
+void rtc_check_complete(I2CTransaction *transaction);
+void rtc_read_complete(I2CTransaction *transaction);
+uint8_t rtc_write(const RTCDate *date);
+void rtc_update(void);
+
+RTCDate gDate = {0, 0, 0, WEEKDAY, DATE, MONTH, YEAR};
+
+int32_t gRTCFrac = 0;               /* CPU cycles into this second */
+uint32_t gRTCSecond = F_CPU;        /* CPU cycles in a DS1307 second */
+uint8_t gRTCLocked = 0;             /* Last edge was within RTC_TRIM_MAX */
+volatile uint8_t gRTCEdges = 0;
+
+/* Watch for the 1 Hz edge going missing */
+uint8_t gRTCLastEdges = 0;
+uint8_t gRTCQuietRuns = 0;
+
+/* Set when the DS1307 should be checked, read or written */
+volatile uint8_t gRTCCheckDue = 0;
+volatile uint8_t gRTCReadDue = 1;
+volatile uint8_t gRTCWriteDue = 0;
+
+/* Time rtc_set was given, until its write to the DS1307 is queued */
+uint8_t gRTCSetDue = 0;
+uint8_t gRTCSetHours;
+uint8_t gRTCSetMinutes;
+uint8_t gRTCSetSeconds;
+
+/* DS1307 transactions, these have to outlive the calls that queue them */
+const uint8_t gRTCAddr = DS1307_SECOND_ADDR;
+const uint8_t gRTCOscStop[] = {DS1307_SECOND_ADDR, DS1307_OSC_STOP};
+const uint8_t gRTCSqw[] = {DS1307_CONTROL_ADDR, DS1307_SQW_1HZ};
+uint8_t gRTCSeconds;
+uint8_t gRTCBuffer[7];
+uint8_t gRTCWriteBuffer[8];
+I2CTransaction gRTCCheck = {DS1307_WRITE, &gRTCAddr, 1, &gRTCSeconds, 1,
+                            rtc_check_complete, I2C_DONE};
+I2CTransaction gRTCRead  = {DS1307_WRITE, &gRTCAddr, 1, gRTCBuffer, 7,
+                            rtc_read_complete, I2C_DONE};
+I2CTransaction gRTCStop  = {DS1307_WRITE, gRTCOscStop, 2, NULL, 0,
+                            NULL, I2C_DONE};
+I2CTransaction gRTCWrite = {DS1307_WRITE, gRTCWriteBuffer, 8, NULL, 0,
+                            NULL, I2C_DONE};
+I2CTransaction gRTCSqwOn = {DS1307_WRITE, gRTCSqw, 2, NULL, 0,
+                            NULL, I2C_DONE};
+
+
+/*
+ * Function:    bcd2bin
+ * --------------------
+ *  Converts the Binary-coded decimal form of a number to the binary form.
+ *  EX: 0x16 BCD
+ *  ------------
+ *      16 - (6 * (16 / 16)) => 0x10 == 16
+ */
+uint8_t bcd2bin (uint8_t val) { return val - 6 * (val >> 4); }
+
+
+/*
+ * Function:    bin2bcd
+ * --------------------
+ *  Converts the binary form of a number to the Binary-coded decimal form.
+ *  EX: 18 binary == 0x12
+ *  ---------------------
+ *      12 + (6 * (12 / 10)) => 12 + 6 * 1 => 0x18 BCD
+ */
+uint8_t bin2bcd (uint8_t val) { return val + 6 * (val / 10); }
+
+
+/*
+ * Function:    month_days
+ * -----------------------
+ *  Returns the days in a month, 1..12, of a year 0..99 of this century.
+ */
+uint8_t month_days(uint8_t month, uint8_t year)
+{
+    if (month == 2)
+        return (year & 3) ? 28 : 29;
+    if (month == 4 || month == 6 || month == 9 || month == 11)
+        return 30;
+    return 31;
+}
+
+
+/*
+ * Function:    rtc_advance
+ * ------------------------
+ *  Moves the time and date forward one second. Once a minute it asks
+ *  for the seconds to be checked against the DS1307.
+ *
+ *  Modifies: gDate, gRTCCheckDue
+ */
+void rtc_advance(void)
+{
+    if (++gDate.seconds < 60)
+        return;
+    gDate.seconds = 0;
+    gRTCCheckDue = 1;
+    if (++gDate.minutes < 60)
+        return;
+    gDate.minutes = 0;
+    if (++gDate.hours < 24)
+        return;
+    gDate.hours = 0;
+    if (++gDate.weekday > 6)
+        gDate.weekday = 0;
+    if (++gDate.date <= month_days(gDate.month, gDate.year))
+        return;
+    gDate.date = 1;
+    if (++gDate.month <= 12)
+        return;
+    gDate.month = 1;
+    if (++gDate.year > 99)
+        gDate.year = 0;
+}
+
+
+/*
+ * Function:    rtc_tick
+ * ---------------------
+ *  Counts a timer tick into the second, called from the TIMER 2
+ *  overflow. While the 1 Hz edge is locked on the second is left to
+ *  it, the tick only rolls it once it is a whole tick overdue.
+ *
+ *  Modifies: gRTCFrac, gDate
+ */
+void rtc_tick(void)
+{
+    int32_t second = gRTCSecond;
+
+    if (gRTCLocked)
+        second += RTC_TICK_CYCLES;
+    gRTCFrac += RTC_TICK_CYCLES;
+    if (gRTCFrac >= second)
+    {
+        gRTCFrac -= gRTCSecond;
+        rtc_advance();
+    }
+}
+
+
+/*
+ * Function:    ISR for INT2 vector
+ * --------------------------------
+ *  Triggers on the falling edge of the DS1307 1 Hz square wave, as
+ *  its seconds register rolls. The phase of the software second here
+ *  is its error, a roll made early shows as a few cycles in, one still
+ *  to come as nearly a whole second. A roll still to come is made now,
+ *  and the second starts again from the edge either way. A TIMER 2
+ *  overflow that came in after this ISR started is not in gRTCFrac
+ *  yet, TCNT2 has wrapped, so it is added here.
+ *
+ *  Modifies: gRTCFrac, gRTCSecond, gRTCLocked, gRTCEdges, gDate
+ */
+ISR(INT2_vect)
+{
+    uint8_t count = TCNT2;
+    int32_t phase = gRTCFrac + (uint32_t)count * (RTC_TICK_CYCLES / 256);
+    int32_t error;
+
+    if ((TIFR & (1 << TOV2)) && count < 128)
+        phase += RTC_TICK_CYCLES;
+
+    if (phase < (int32_t)(gRTCSecond / 2))
+        error = phase;
+    else
+    {
+        error = phase - gRTCSecond;
+        rtc_advance();
+    }
+    gRTCFrac -= phase;
+    gRTCEdges++;
+
+    if (error < -RTC_TRIM_MAX || error > RTC_TRIM_MAX)
+    {
+        gRTCLocked = 0;
+        return;
+    }
+    if (gRTCLocked)
+    {
+        gRTCSecond += error / RTC_TRIM_GAIN;
+        if (gRTCSecond > F_CPU + RTC_TRIM_MAX)
+            gRTCSecond = F_CPU + RTC_TRIM_MAX;
+        else if (gRTCSecond < F_CPU - RTC_TRIM_MAX)
+            gRTCSecond = F_CPU - RTC_TRIM_MAX;
+    }
+    gRTCLocked = 1;
+}
+
+
+/*
+ * Function:    rtc_check_complete
+ * -------------------------------
+ *  Callback for the single byte read of the DS1307 seconds, runs from
+ *  the TWI interrupt. Only if they disagree with the software clock is
+ *  the whole time read. A stopped oscillator is written back instead,
+ *  its time is stale.
+ *
+ *  Modifies: gRTCReadDue, gRTCWriteDue
+ */
+void rtc_check_complete(I2CTransaction *transaction)
+{
+    if (transaction->status != I2C_DONE)
+        return;
+
+    if (gRTCSeconds & DS1307_OSC_STOP)
+        gRTCWriteDue = 1;
+    else if (bcd2bin(gRTCSeconds) != gDate.seconds)
+        gRTCReadDue = 1;
+}
+
+
+/*
+ * Function:    rtc_read_complete
+ * ------------------------------
+ *  Callback for the read of all seven DS1307 registers, runs from the
+ *  TWI interrupt. The data read off must be converted from Binary
+ *  coded data to decimal. If the oscillator had stopped the time is
+ *  taken anyway, there is nothing better, and written back to start it.
+ *
+ *  Modifies: gDate, gRTCWriteDue
+ */
+void rtc_read_complete(I2CTransaction *transaction)
+{
+    if (transaction->status != I2C_DONE)
+        return;
+
+    gDate.seconds = bcd2bin(gRTCBuffer[0] & ~DS1307_OSC_STOP);
+    gDate.minutes = bcd2bin(gRTCBuffer[1]);
+    gDate.hours = bcd2bin(gRTCBuffer[2] & 0x3F);
+    gDate.weekday = bcd2bin(gRTCBuffer[3]);
+    gDate.date = bcd2bin(gRTCBuffer[4]);
+    gDate.month = bcd2bin(gRTCBuffer[5]);
+    gDate.year = bcd2bin(gRTCBuffer[6]);
+
+    if (gRTCBuffer[0] & DS1307_OSC_STOP)
+        gRTCWriteDue = 1;
+}
+
+
+/*
+ * Function:    rtc_write
+ * ----------------------
+ *  Queues a write of date to the DS1307, after one that disables the
+ *  oscillator. Writing the seconds restarts the DS1307 second. The two
+ *  are queued together or not at all, a stop with no write after it
+ *  would leave the DS1307 halted. Never waits: while the last update
+ *  is still on the bus its buffer can not be changed, and the queue
+ *  may not have two free slots, then it returns 1 and the caller keeps
+ *  the write due for the next rtc_poll.
+ *
+ *  Modifies: DS1307, gRTCWriteBuffer
+ */
+uint8_t rtc_write(const RTCDate *date)
+{
+    if (gRTCStop.status == I2C_PENDING || gRTCWrite.status == I2C_PENDING)
+        return 1;
+
+    gRTCWriteBuffer[0] = DS1307_SECOND_ADDR;
+    gRTCWriteBuffer[1] = bin2bcd(date->seconds);
+    gRTCWriteBuffer[2] = bin2bcd(date->minutes);
+    gRTCWriteBuffer[3] = bin2bcd(date->hours);
+    gRTCWriteBuffer[4] = bin2bcd(date->weekday);
+    gRTCWriteBuffer[5] = bin2bcd(date->date);
+    gRTCWriteBuffer[6] = bin2bcd(date->month);
+    gRTCWriteBuffer[7] = bin2bcd(date->year);
+
+    return i2c_submit_pair(&gRTCStop, &gRTCWrite);
+}
+
+
+/*
+ * Function:    rtc_update
+ * -----------------------
+ *  Writes the time rtc_set was given to the DS1307, and only once the
+ *  write is queued moves the software clock to it, so the two always
+ *  agree. A read of the DS1307 already on the bus is let finish first,
+ *  otherwise the time it brings back would undo the new one. Left due
+ *  if it can not be queued yet.
+ *
+ *  Modifies: gDate, gRTCFrac, gRTCSetDue, gRTCWriteDue, DS1307
+ */
+void rtc_update(void)
+{
+    RTCDate date;
+
+    if (gRTCRead.status == I2C_PENDING || gRTCCheck.status == I2C_PENDING)
+        return;
+
+    rtc_get(&date);
+    date.hours = gRTCSetHours;
+    date.minutes = gRTCSetMinutes;
+    date.seconds = gRTCSetSeconds;
+    if (rtc_write(&date))
+        return;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        gDate.hours = date.hours;
+        gDate.minutes = date.minutes;
+        gDate.seconds = date.seconds;
+        gRTCFrac = 0;
+    }
+    gRTCSetDue = 0;
+    gRTCWriteDue = 0;
+}
+
+
+/*
+ * Function:    rtc_init
+ * ---------------------
+ *  Turns on the 1 Hz square wave on the DS1307 SQW/OUT pin and sets
+ *  up INT2 to see its falling edges, which is when the DS1307 rolls
+ *  its seconds register. SQW/OUT is open drain so it needs the pullup.
+ *  The ISC2 edge can only be changed while INT2 is disabled, and
+ *  changing it can set the flag, so it is cleared before enabling. The
+ *  first rtc_poll reads the whole time.
+ *
+ *  Modifies: DS1307 control register, PORTB, MCUCSR, GIFR, GICR
+ */
+void rtc_init(void)
+{
+    i2c_submit(&gRTCSqwOn);
+
+    PORTB  |= (1 << DS1307_SQW_PIN);                /* SQW/OUT pullup */
+    GICR   &= ~(1 << INT2);
+    MCUCSR &= ~(1 << ISC2);                         /* Falling edge INT2 */
+    HAL_FLAG_CLEAR(GIFR, 1 << INTF2);
+    GICR   |= (1 << INT2);
+}
+
+
+/*
+ * Function:    rtc_get
+ * --------------------
+ *  Copies out the date and time, all from the same second.
+ *
+ *  Modifies: date
+ */
+void rtc_get(RTCDate *date)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        *date = gDate;
+    }
+}
+
+
+/*
+ * Function:    rtc_set
+ * --------------------
+ *  Sets the time, keeping the date, and writes it to the DS1307. The
+ *  second starts again from when the write is queued, as the DS1307
+ *  one does. That is straight away unless the bus is busy, then
+ *  rtc_poll keeps trying and the clock runs on meanwhile.
+ *
+ *  Modifies: gRTCSetHours, gRTCSetMinutes, gRTCSetSeconds, gRTCSetDue
+ *  Calls: rtc_update
+ */
+void rtc_set(uint8_t hours, uint8_t minutes, uint8_t seconds)
+{
+    gRTCSetHours = hours;
+    gRTCSetMinutes = minutes;
+    gRTCSetSeconds = seconds;
+    gRTCSetDue = 1;
+    rtc_update();
+}
+
+
+/*
+ * Function:    rtc_poll
+ * ---------------------
+ *  Goes to the DS1307 for whatever is due, from the main loop. While
+ *  the 1 Hz edge has gone missing for RTC_QUIET_RUNS polls the tick is
+ *  keeping the second alone, and the seconds are checked every time
+ *  that comes round again.
+ *
+ *  Modifies: gRTCLastEdges, gRTCQuietRuns, gRTCLocked, gRTCCheckDue,
+ *            gRTCReadDue, gRTCWriteDue
+ *  Calls: rtc_update
+ */
+void rtc_poll(void)
+{
+    uint8_t edges = gRTCEdges;
+    RTCDate date;
+
+    if (edges != gRTCLastEdges)
+    {
+        gRTCLastEdges = edges;
+        gRTCQuietRuns = 0;
+    }
+    else if (++gRTCQuietRuns > RTC_QUIET_RUNS)
+    {
+        gRTCQuietRuns = 0;
+        gRTCLocked = 0;
+        gRTCCheckDue = 1;
+    }
+
+    if (gRTCSetDue)
+    {
+        rtc_update();
+    }
+    else if (gRTCWriteDue)
+    {
+        rtc_get(&date);
+        if (!rtc_write(&date))
+            gRTCWriteDue = 0;
+    }
+    else if (gRTCReadDue && gRTCRead.status != I2C_PENDING)
+    {
+        gRTCReadDue = 0;
+        gRTCCheckDue = 0;
+        if (i2c_submit(&gRTCRead))
+            gRTCReadDue = 1;
+    }
+    else if (gRTCCheckDue && gRTCCheck.status != I2C_PENDING)
+    {
+        gRTCCheckDue = 0;
+        if (i2c_submit(&gRTCCheck))
+            gRTCCheckDue = 1;
+    }
+}
+
+
+/*
+ * Function:    rtc_ppm
+ * --------------------
+ *  Returns how fast the CPU clock runs against the DS1307, in parts
+ *  per million, from the trimmed length of a second.
+ */
+int16_t rtc_ppm(void)
+{
+    int32_t trim;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        trim = (int32_t)(gRTCSecond - F_CPU);
+    }
+    return trim / (F_CPU / 1000000);
+}
@@ -0,0 +1,42 @@
+#ifndef RTC_H
+#define RTC_H
+
+#include <stdint.h>
+
+/*
+ * Software real time clock. The full date and time are kept here,
+ * moved on by the timer tick, so there is always a time to show even
+ * while the DS1307 is not answering. The DS1307 keeps it right:
+ *
+ *  - its 1 Hz edge lines the second up and trims how many CPU cycles
+ *    the tick counts as one
+ *  - once a minute just its seconds register is read back, a single
+ *    byte, and only if that disagrees are all seven read again
+ *  - if its oscillator has stopped it is written back from here
+ *
+ * gDate changes from interrupts, read it with rtc_get.
+ */
+typedef struct RTCDate
+{
+    uint8_t seconds;
+    uint8_t minutes;
+    uint8_t hours;
+    uint8_t weekday;
+    uint8_t date;
+    uint8_t month;
+    uint8_t year;
+} RTCDate;
+
+extern RTCDate gDate;
+extern uint32_t gRTCSecond;
+
+uint8_t bcd2bin(uint8_t);
+uint8_t bin2bcd(uint8_t);
+void rtc_init(void);
+void rtc_get(RTCDate *date);
+void rtc_set(uint8_t hours, uint8_t minutes, uint8_t seconds);
+void rtc_tick(void);
+void rtc_poll(void);
+int16_t rtc_ppm(void);
+
+#endif
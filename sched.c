@@ -0,0 +1,153 @@
+/*
+ * File:    sched.c
+ * Description: Tick driven cooperative scheduler. The timer tick only
+ *              counts, sched_run in the main loop takes the ticks that
+ *              have gone by, runs every task that came due and then
+ *              idles the CPU until the next interrupt.
+ */
+
+#include <stddef.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+
+#include "sched.h"
+#include "stats.h"
+
+Task gTasks[SCHED_MAX_TASKS];
+uint8_t gNumTasks = 0;
+volatile uint8_t gSchedTicks = 0;
+
+
+/*
+ * Function:    sched_add
+ * ----------------------
+ *  Adds a task, stopped. Returns its id, or 0xFF if the table is full.
+ *
+ *  Modifies: gTasks, gNumTasks
+ */
+uint8_t sched_add(void (*run)(void), uint8_t period)
+{
+    if (gNumTasks >= SCHED_MAX_TASKS)
+        return 0xFF;
+
+    gTasks[gNumTasks].run = run;
+    gTasks[gNumTasks].period = period;
+    gTasks[gNumTasks].active = 0;
+    return gNumTasks++;
+}
+
+
+/*
+ * Function:    sched_start
+ * ------------------------
+ *  Runs a task after delay ticks, then every period if it has one. A
+ *  delay of 0 runs it on the next tick. Starting a task that is already
+ *  waiting moves it to the new time, so repeated starts of a one shot
+ *  run it once, delay after the last.
+ *
+ *  Modifies: gTasks[id]
+ */
+void sched_start(uint8_t id, uint8_t delay)
+{
+    gTasks[id].due = delay ? delay : 1;
+    gTasks[id].active = 1;
+}
+
+
+/*
+ * Function:    sched_stop
+ * -----------------------
+ *  Stops a task before it runs again.
+ *
+ *  Modifies: gTasks[id]
+ */
+void sched_stop(uint8_t id)
+{
+    gTasks[id].active = 0;
+}
+
+
+/*
+ * Function:    sched_tick
+ * -----------------------
+ *  Counts a tick. Called from the timer tick interrupt.
+ *
+ *  Modifies: gSchedTicks
+ */
+void sched_tick(void)
+{
+    if (gSchedTicks < 0xFF)
+        gSchedTicks++;
+}
+
+
+/*
+ * Function:    sched_run
+ * ----------------------
+ *  One pass of the main loop. Runs the tasks that came due in the ticks
+ *  since the last pass, in the order they were added, then sleeps in
+ *  idle mode. Every interrupt wakes the CPU, the sector ISRs included,
+ *  so the sleep is checked again on each return. Interrupts are off
+ *  between the check and the sleep so a tick can not slip in unseen,
+ *  the instruction after sei always runs before an interrupt is taken.
+ *
+ *  Modifies: gSchedTicks, gTasks
+ */
+void sched_run(void)
+{
+    uint8_t elapsed;
+
+    ATOMIC_BLOCK(ATOMIC_FORCEON)
+    {
+        elapsed = gSchedTicks;
+        gSchedTicks = 0;
+    }
+
+    if (elapsed)
+    {
+        STATS_LOOP_START();
+
+        for (uint8_t i = 0; i < gNumTasks; i++)
+        {
+            Task *task = &gTasks[i];
+
+            if (!task->active)
+                continue;
+            if (task->due > elapsed)
+            {
+                task->due -= elapsed;
+                continue;
+            }
+
+#ifdef STATS
+            if (elapsed - task->due > task->late_max)
+                task->late_max = elapsed - task->due;
+            uint16_t start = TCNT1;
+#endif
+            task->due = task->period;
+            if (!task->period)
+                task->active = 0;
+            task->run();
+#ifdef STATS
+            uint16_t ran = TCNT1 - start;
+            if (ran > task->run_max)
+                task->run_max = ran;
+#endif
+        }
+
+        STATS_LOOP_END();
+    }
+
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    cli();
+    if (!gSchedTicks)
+    {
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+    }
+    sei();
+}
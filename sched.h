@@ -0,0 +1,36 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+
+/* Most tasks that can be added, a task id is its index */
+#define SCHED_MAX_TASKS 8
+
+/*
+ * A cooperative task, run from sched_run in the main loop. A periodic
+ * task runs every period ticks, a one shot (period 0) runs once when
+ * it comes due and then waits to be started again with sched_start.
+ * Tasks run to completion, one at a time, and never from an interrupt.
+ */
+typedef struct Task
+{
+    void (*run)(void);
+    uint8_t period;             /* Ticks between runs, 0 for one shot */
+    uint8_t due;                /* Ticks until the next run */
+    uint8_t active;
+#ifdef STATS
+    uint8_t late_max;           /* Worst ticks run after it came due */
+    uint16_t run_max;           /* Worst run time, TIMER 1 ticks */
+#endif
+} Task;
+
+extern Task gTasks[SCHED_MAX_TASKS];
+extern uint8_t gNumTasks;
+
+uint8_t sched_add(void (*run)(void), uint8_t period);
+void sched_start(uint8_t id, uint8_t delay);
+void sched_stop(uint8_t id);
+void sched_tick(void);
+void sched_run(void);
+
+#endif
@@ -0,0 +1,136 @@
+/*
+ * File:    settings.c
+ * Description: Settings store, a ring of CRC checked records across the
+ *              whole EEPROM, see settings.h.
+ *
+ * A save never waits on the EEPROM. The record is copied and then
+ * written a byte at a time from EE_RDY_vect, which comes back as each
+ * write finishes, about 8.5 ms apart. Bytes the slot already holds are
+ * skipped. The CRC goes last, so a record cut short by a reset does not
+ * check out and the one before it is used instead.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+
+#include "settings.h"
+
+Settings gSettingsWrite;                /* Record being written */
+uint8_t *gSettingsAddr;                 /* Its next byte in EEPROM */
+volatile uint8_t gSettingsLeft = 0;     /* Bytes still to write */
+uint8_t gSettingsSlot = SETTINGS_SLOTS - 1;     /* Newest record */
+uint8_t gSettingsSequence = 0xFF;
+
+
+/*
+ * Function:    settings_crc
+ * -------------------------
+ *  Returns the CRC of every byte of a record but the CRC itself.
+ */
+uint8_t settings_crc(const Settings *settings)
+{
+    const uint8_t *data = (const uint8_t *)settings;
+    uint8_t crc = 0;
+
+    for (uint8_t i = 0; i < sizeof(Settings) - 1; i++)
+        crc = _crc_ibutton_update(crc, data[i]);
+    return crc;
+}
+
+
+/*
+ * Function:    settings_load
+ * --------------------------
+ *  Finds the newest good record. Sequences are compared by their
+ *  difference, which keeps working as they wrap past 255, all the
+ *  records in the ring are within SETTINGS_SLOTS of each other. Returns
+ *  0 if there is no good record at all, a fresh or corrupted EEPROM,
+ *  and the caller has to fall back to its defaults.
+ *
+ *  Modifies: settings, gSettingsSlot, gSettingsSequence
+ */
+uint8_t settings_load(Settings *settings)
+{
+    Settings record;
+    uint8_t found = 0;
+
+    for (uint8_t slot = 0; slot < SETTINGS_SLOTS; slot++)
+    {
+        eeprom_read_block(&record, (const void *)(slot * sizeof(Settings)),
+                          sizeof(Settings));
+        if (record.version != SETTINGS_VERSION ||
+            record.crc != settings_crc(&record))
+            continue;
+        if (found && (int8_t)(record.sequence - gSettingsSequence) <= 0)
+            continue;
+
+        *settings = record;
+        gSettingsSlot = slot;
+        gSettingsSequence = record.sequence;
+        found = 1;
+    }
+    return found;
+}
+
+
+/*
+ * Function:    settings_save
+ * --------------------------
+ *  Starts writing the settings into the slot after the newest record
+ *  and returns straight away. Returns 0 if the last save is still
+ *  being written, try again later.
+ *
+ *  Modifies: gSettingsWrite, gSettingsAddr, gSettingsLeft, gSettingsSlot,
+ *            gSettingsSequence, EECR
+ */
+uint8_t settings_save(const Settings *settings)
+{
+    if (gSettingsLeft)
+        return 0;
+
+    gSettingsWrite = *settings;
+    gSettingsWrite.version = SETTINGS_VERSION;
+    gSettingsWrite.sequence = ++gSettingsSequence;
+    gSettingsWrite.crc = settings_crc(&gSettingsWrite);
+
+    if (++gSettingsSlot >= SETTINGS_SLOTS)
+        gSettingsSlot = 0;
+    gSettingsAddr = (uint8_t *)(gSettingsSlot * sizeof(Settings));
+    gSettingsLeft = sizeof(Settings);
+    EECR |= (1 << EERIE);
+    return 1;
+}
+
+
+/*
+ * Function:    ISR for EE_RDY vector
+ * ----------------------------------
+ *  Triggers whenever the EEPROM is ready and the interrupt is on.
+ *  Starts the write of the next byte that differs from what is there,
+ *  once there are none left the interrupt goes off again. EEWE has to
+ *  be set within four cycles of EEMWE, interrupts are off in here.
+ *
+ *  Modifies: gSettingsAddr, gSettingsLeft, EEAR, EEDR, EECR
+ */
+ISR(EE_RDY_vect)
+{
+    const uint8_t *data = (const uint8_t *)&gSettingsWrite;
+
+    while (gSettingsLeft)
+    {
+        uint8_t *addr = gSettingsAddr++;
+        uint8_t value = data[sizeof(Settings) - gSettingsLeft--];
+
+        if (eeprom_read_byte(addr) != value)
+        {
+            EEAR = (uintptr_t)addr;
+            EEDR = value;
+            EECR |= (1 << EEMWE);
+            EECR |= (1 << EEWE);
+            return;
+        }
+    }
+    EECR &= ~(1 << EERIE);
+}
@@ -0,0 +1,36 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <stdint.h>
+#include <avr/io.h>
+
+/*
+ * The saved settings. Each save goes into the next slot of a ring that
+ * covers the whole EEPROM, so the wear is spread over every cell. A
+ * record counts only if its version and CRC check out, and the newest
+ * is the good record with the highest sequence. Sequences are compared
+ * by their signed 8 bit difference, so they can wrap past 255. Raise
+ * SETTINGS_VERSION whenever the layout changes.
+ */
+#define SETTINGS_VERSION    3
+
+typedef struct Settings
+{
+    uint8_t version;
+    uint8_t sequence;           /* One up on the record before */
+    uint16_t phase;             /* Sectors */
+    uint16_t latency;           /* Microseconds */
+    uint8_t background;
+    uint8_t hour_color;
+    uint8_t minute_color;
+    uint8_t second_color;
+    uint8_t animation;
+    uint8_t crc;                /* iButton CRC-8 of the bytes before it */
+} Settings;
+
+#define SETTINGS_SLOTS      ((E2END + 1) / sizeof(Settings))
+
+uint8_t settings_load(Settings *settings);
+uint8_t settings_save(const Settings *settings);
+
+#endif
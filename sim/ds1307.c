@@ -0,0 +1,279 @@
+/*
+ * File:    ds1307.c
+ * Description: Simulated TWI master and the DS1307 on its bus. Bus
+ *              actions start when the firmware writes TWCR with TWINT
+ *              set and finish a bus time later with TWINT raised again.
+ *              The DS1307 keeps BCD time, advances it once a second and
+ *              drives SQW/OUT into INT2.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <avr/io.h>
+#include <util/twi.h>
+
+#include "constants.h"
+#include "sim.h"
+
+#define DS1307_SLA      (DS1307_WRITE >> 1)
+
+/* Bus times at 100 kHz, in CPU cycles */
+#define TWI_BIT_CYCLES  (F_CPU / 100000)
+#define TWI_START_TIME  (2 * TWI_BIT_CYCLES)
+#define TWI_BYTE_TIME   (9 * TWI_BIT_CYCLES)
+
+enum
+{
+    BUS_IDLE,
+    BUS_STARTED,
+    BUS_WRITE,
+    BUS_READ,
+    BUS_NOT_US
+} gTwiState = BUS_IDLE;
+
+uint8_t gTwiPending = 0;
+uint64_t gTwiDoneAt;
+uint8_t gTwiStatus;
+uint8_t gTwiData;
+uint8_t gTwiPointerNext = 0;
+
+uint8_t gDs1307[64];
+uint8_t gDs1307Pointer = 0;
+uint64_t gDs1307NextSecond;
+uint64_t gDs1307Second = F_CPU;     /* Its second in CPU cycles */
+uint64_t gDs1307LostAt = UINT64_MAX;
+
+
+uint8_t bcd_in(uint8_t val) { return val - 6 * (val >> 4); }
+uint8_t bcd_out(uint8_t val) { return val + 6 * (val / 10); }
+
+
+/*
+ * Function:    schedule
+ * ---------------------
+ *  Finishes the current bus action after the given number of cycles.
+ */
+void schedule(uint8_t status, uint32_t cycles)
+{
+    gTwiPending = 1;
+    gTwiStatus = status;
+    gTwiDoneAt = gSimCycles + cycles;
+}
+
+
+/*
+ * Function:    ds1307_write
+ * -------------------------
+ *  Stores a register. Writing the seconds register restarts the
+ *  one second countdown, as it does on the part.
+ */
+void ds1307_write(uint8_t reg, uint8_t value)
+{
+    gDs1307[reg & 0x3F] = value;
+    if ((reg & 0x3F) == DS1307_SECOND_ADDR)
+        gDs1307NextSecond = gSimCycles + gDs1307Second;
+}
+
+
+/*
+ * Function:    sim_twcr_write
+ * ---------------------------
+ *  Firmware write of TWCR. Writing TWINT clears it and starts whatever
+ *  action the other bits ask for.
+ */
+void sim_twcr_write(uint8_t value)
+{
+    TWCR = value & ~((1 << TWINT) | (1 << TWSTO));
+
+    if (!(value & (1 << TWINT)) || !(value & (1 << TWEN)))
+        return;
+
+    if (value & (1 << TWSTO))
+    {
+        gTwiState = BUS_IDLE;
+        gTwiPending = 0;
+        if (value & (1 << TWSTA))
+        {
+            gTwiState = BUS_STARTED;
+            schedule(TW_START, 2 * TWI_START_TIME);
+        }
+        return;
+    }
+
+    if (value & (1 << TWSTA))
+    {
+        schedule(gTwiState == BUS_IDLE ? TW_START : TW_REP_START,
+                 TWI_START_TIME);
+        gTwiState = BUS_STARTED;
+        return;
+    }
+
+    switch (gTwiState)
+    {
+    case BUS_STARTED:
+        if ((TWDR >> 1) == DS1307_SLA && gSimCycles < gDs1307LostAt)
+        {
+            gTwiState = (TWDR & 0x01) ? BUS_READ : BUS_WRITE;
+            gTwiPointerNext = 1;
+            schedule((TWDR & 0x01) ? TW_MR_SLA_ACK : TW_MT_SLA_ACK,
+                     TWI_BYTE_TIME);
+        }
+        else
+        {
+            gTwiState = BUS_NOT_US;
+            schedule((TWDR & 0x01) ? TW_MR_SLA_NACK : TW_MT_SLA_NACK,
+                     TWI_BYTE_TIME);
+        }
+        break;
+
+    case BUS_WRITE:
+        if (gTwiPointerNext)
+            gDs1307Pointer = TWDR & 0x3F;
+        else
+            ds1307_write(gDs1307Pointer++, TWDR);
+        gTwiPointerNext = 0;
+        gDs1307Pointer &= 0x3F;
+        schedule(TW_MT_DATA_ACK, TWI_BYTE_TIME);
+        break;
+
+    case BUS_READ:
+        gTwiData = gDs1307[gDs1307Pointer++ & 0x3F];
+        gDs1307Pointer &= 0x3F;
+        schedule((value & (1 << TWEA)) ? TW_MR_DATA_ACK : TW_MR_DATA_NACK,
+                 TWI_BYTE_TIME);
+        break;
+
+    default:
+        schedule(TW_BUS_ERROR, TWI_BYTE_TIME);
+        break;
+    }
+}
+
+
+/*
+ * Function:    ds1307_tick
+ * ------------------------
+ *  Advances the BCD time one second, 24 hour mode only.
+ */
+void ds1307_tick(void)
+{
+    static const uint8_t days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    uint8_t sec = bcd_in(gDs1307[0] & 0x7F);
+    uint8_t min = bcd_in(gDs1307[1]);
+    uint8_t hour = bcd_in(gDs1307[2] & 0x3F);
+    uint8_t day = bcd_in(gDs1307[3]);
+    uint8_t date = bcd_in(gDs1307[4]);
+    uint8_t month = bcd_in(gDs1307[5]);
+    uint8_t year = bcd_in(gDs1307[6]);
+
+    if (++sec > 59)
+    {
+        sec = 0;
+        if (++min > 59)
+        {
+            min = 0;
+            if (++hour > 23)
+            {
+                hour = 0;
+                day = (day + 1) % 7;
+                uint8_t last = days[(month + 11) % 12];
+                if (month == 2 && year % 4 == 0)
+                    last++;
+                if (++date > last)
+                {
+                    date = 1;
+                    if (++month > 12)
+                    {
+                        month = 1;
+                        year = (year + 1) % 100;
+                    }
+                }
+            }
+        }
+    }
+
+    gDs1307[0] = bcd_out(sec);
+    gDs1307[1] = bcd_out(min);
+    gDs1307[2] = bcd_out(hour);
+    gDs1307[3] = bcd_out(day);
+    gDs1307[4] = bcd_out(date);
+    gDs1307[5] = bcd_out(month);
+    gDs1307[6] = bcd_out(year);
+}
+
+
+/*
+ * Function:    ds1307_step
+ * ------------------------
+ *  Finishes bus actions that are due and keeps the DS1307 time. The
+ *  1 Hz SQW/OUT falls as the seconds register rolls.
+ */
+void ds1307_step(void)
+{
+    if (gTwiPending && gSimCycles >= gTwiDoneAt)
+    {
+        gTwiPending = 0;
+        if (gTwiState == BUS_READ && (gTwiStatus == TW_MR_DATA_ACK ||
+                                      gTwiStatus == TW_MR_DATA_NACK))
+            TWDR = gTwiData;
+        TWSR = gTwiStatus;
+        TWCR |= (1 << TWINT);
+    }
+
+    if (gSimCycles >= gDs1307NextSecond)
+    {
+        gDs1307NextSecond += gDs1307Second;
+        if (gDs1307[0] & DS1307_OSC_STOP)
+            return;
+
+        ds1307_tick();
+        if (gSimCycles < gDs1307LostAt &&
+            (gDs1307[DS1307_CONTROL_ADDR] & 0x13) == DS1307_SQW_1HZ &&
+            !(MCUCSR & (1 << ISC2)))
+            GIFR |= (1 << INTF2);
+    }
+}
+
+
+/*
+ * Function:    ds1307_init
+ * ------------------------
+ *  Sets the starting time, HH:MM:SS, defaulting to 10:10:00. ppm is
+ *  how fast its crystal runs against the CPU one, from lost seconds on
+ *  it neither answers on the bus nor drives SQW/OUT, either may be
+ *  NULL.
+ */
+void ds1307_init(const char *time, const char *ppm, const char *lost)
+{
+    int hour = 10, min = 10, sec = 0;
+
+    if (time)
+        sscanf(time, "%d:%d:%d", &hour, &min, &sec);
+
+    gDs1307[0] = bcd_out(sec % 60);
+    gDs1307[1] = bcd_out(min % 60);
+    gDs1307[2] = bcd_out(hour % 24);
+    gDs1307[3] = 0;
+    gDs1307[4] = bcd_out(DATE);
+    gDs1307[5] = bcd_out(MONTH);
+    gDs1307[6] = bcd_out(YEAR);
+
+    if (ppm)
+        gDs1307Second = (uint64_t)(F_CPU / (1.0 + atof(ppm) / 1e6));
+    if (lost)
+        gDs1307LostAt = (uint64_t)(atof(lost) * F_CPU);
+    gDs1307NextSecond = gDs1307Second;
+}
+
+
+/*
+ * Function:    ds1307_time
+ * ------------------------
+ *  Formats the DS1307 time as HH:MM:SS, buf holds at least 12.
+ */
+void ds1307_time(char *buf)
+{
+    snprintf(buf, 12, "%02u:%02u:%02u", bcd_in(gDs1307[2] & 0x3F),
+             bcd_in(gDs1307[1]), bcd_in(gDs1307[0] & 0x7F));
+}
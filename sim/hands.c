@@ -0,0 +1,100 @@
+/*
+ * File:    hands.c
+ * Description: Host check of the hand positions. Runs the integer
+ *              calculate_*_position routines for every hour, minute and
+ *              second and compares them with the float routines they
+ *              replaced, done in single precision as avr-gcc did them.
+ */
+
+#include <stdio.h>
+
+#include "constants.h"
+#include "hands.h"
+#include "sim.h"
+
+uint16_t gHandChecks = 0;
+uint16_t gHandShort = 0;
+uint16_t gHandFails = 0;
+
+
+/*
+ * Function:    hand_position
+ * --------------------------
+ *  The sector a hand is centered on, undoing place_hand.
+ */
+sector_t hand_position(const Hand *hand)
+{
+    return (hand->layer->start + hand->layer->width / 2) % RESOLUTION;
+}
+
+
+/*
+ * Function:    check_hand
+ * -----------------------
+ *  Compares one position with the float one. The float routines
+ *  truncate, so where the exact position is a whole sector they can
+ *  land one short of it, that is counted but is not a failure. num /
+ *  60 is the exact position.
+ */
+void check_hand(const char *name, uint16_t value, sector_t pos, float old,
+                uint32_t num)
+{
+    sector_t was = (sector_t)old;
+
+    gHandChecks++;
+    if (pos == was)
+        return;
+    if (pos == was + 1 && num % 60 == 0 && pos == num / 60)
+    {
+        gHandShort++;
+        return;
+    }
+    gHandFails++;
+    printf("sim: %s hand at %u is at sector %u, float gave %u\n",
+           name, value, pos, was);
+}
+
+
+/*
+ * Function:    sim_check_hands
+ * ----------------------------
+ *  Runs the check, every hour 0 to 23 with every minute, every minute
+ *  and every second. Returns the exit status, 1 if any differ.
+ */
+int sim_check_hands(void)
+{
+    init_layers();
+    gSweepSecond = 0xFF;                /* No sweep steps on the second hand */
+
+    gSecondHand.value = 0;
+    for (uint8_t h = 0; h < 24; h++)
+    {
+        for (uint8_t m = 0; m < 60; m++)
+        {
+            gHourHand.value = h;
+            gMinuteHand.value = m;
+            calculate_hour_position();
+            check_hand("hour", h * 100 + m, hand_position(&gHourHand),
+                       ((h % 12) + (m / 60.0f)) * SECTORS_PER_HOUR,
+                       ((h % 12) * 60UL + m) * SECTORS_PER_HOUR);
+        }
+    }
+
+    for (uint8_t v = 0; v < 60; v++)
+    {
+        gMinuteHand.value = v;
+        gSecondHand.value = 0;
+        calculate_minute_position();
+        check_hand("minute", v, hand_position(&gMinuteHand),
+                   (v / 60.0f) * RESOLUTION, v * (uint32_t)RESOLUTION);
+
+        gSecondHand.value = v;
+        calculate_second_position();
+        check_hand("second", v, hand_position(&gSecondHand),
+                   (v / 60.0f) * RESOLUTION, v * (uint32_t)RESOLUTION);
+    }
+
+    printf("sim: hands checked at %u times, %u where float fell a sector "
+           "short, %u wrong\n", gHandChecks, gHandShort, gHandFails);
+    return gHandFails ? 1 : 0;
+}
@@ -0,0 +1,16 @@
+#ifndef SIM_AVR_EEPROM_H
+#define SIM_AVR_EEPROM_H
+
+/* Host stand in for <avr/eeprom.h>, backed by an array in sim/sim.c */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define EEMEM
+
+uint8_t eeprom_read_byte(const uint8_t *addr);
+void eeprom_write_byte(uint8_t *addr, uint8_t value);
+void eeprom_update_byte(uint8_t *addr, uint8_t value);
+void eeprom_read_block(void *dst, const void *src, size_t n);
+
+#endif
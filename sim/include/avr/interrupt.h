@@ -0,0 +1,41 @@
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+
+/*
+ * Host stand in for <avr/interrupt.h>. An ISR is an ordinary function
+ * named after its vector, sim/sim.c calls it when its flag is raised.
+ * Every vector is declared weak so the ones the firmware does not use
+ * resolve to NULL.
+ */
+
+#include <avr/io.h>
+
+#define ISR(vector, ...)    void vector(void)
+#define ISR_NAKED
+#define ISR_BLOCK
+#define ISR_NOBLOCK
+#define reti()              return
+
+#define sei()               (SREG |= 0x80)
+#define cli()               (SREG &= ~0x80)
+
+#define SIM_VECTOR(v) void v(void) __attribute__((weak));
+SIM_VECTOR(INT0_vect)
+SIM_VECTOR(INT1_vect)
+SIM_VECTOR(TIMER2_COMP_vect)
+SIM_VECTOR(TIMER2_OVF_vect)
+SIM_VECTOR(TIMER1_CAPT_vect)
+SIM_VECTOR(TIMER1_COMPA_vect)
+SIM_VECTOR(TIMER1_COMPB_vect)
+SIM_VECTOR(TIMER1_OVF_vect)
+SIM_VECTOR(TIMER0_OVF_vect)
+SIM_VECTOR(USART_RXC_vect)
+SIM_VECTOR(USART_UDRE_vect)
+SIM_VECTOR(USART_TXC_vect)
+SIM_VECTOR(EE_RDY_vect)
+SIM_VECTOR(TWI_vect)
+SIM_VECTOR(INT2_vect)
+SIM_VECTOR(TIMER0_COMP_vect)
+#undef SIM_VECTOR
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+
+/*
+ * Host stand in for <avr/io.h>. Every ATmega16 register the firmware
+ * uses is a plain variable owned by sim/sim.c, and the bit names have
+ * the same values as on the part.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define _BV(bit) (1 << (bit))
+
+/* 8 bit registers */
+extern volatile uint8_t PORTA, PINA, DDRA;
+extern volatile uint8_t PORTB, PINB, DDRB;
+extern volatile uint8_t PORTC, PINC, DDRC;
+extern volatile uint8_t PORTD, PIND, DDRD;
+extern volatile uint8_t SREG, MCUCR, MCUCSR, GICR, GIFR, TIMSK, TIFR;
+extern volatile uint8_t TCCR0, TCNT0, OCR0;
+extern volatile uint8_t TCCR1A, TCCR1B;
+extern volatile uint8_t TCCR2, TCNT2, OCR2;
+extern volatile uint8_t TWBR, TWSR, TWAR, TWDR, TWCR;
+extern volatile uint8_t UCSRA, UCSRB, UCSRC, UBRRH, UBRRL, UDR;
+extern volatile uint8_t EECR, EEDR;
+
+/* 16 bit registers */
+extern volatile uint16_t TCNT1, OCR1A, OCR1B, ICR1, EEAR;
+
+/* Port pins */
+#define PA0 0
+#define PA1 1
+#define PA2 2
+#define PA3 3
+#define PA4 4
+#define PA5 5
+#define PA6 6
+#define PA7 7
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+/* MCUCR, MCUCSR */
+#define ISC00 0
+#define ISC01 1
+#define ISC10 2
+#define ISC11 3
+#define SM0   4
+#define SM1   5
+#define SE    6
+#define SM2   7
+#define ISC2  6
+
+/* GICR, GIFR */
+#define INT2  5
+#define INT0  6
+#define INT1  7
+#define INTF2 5
+#define INTF0 6
+#define INTF1 7
+
+/* TIMSK, TIFR */
+#define TOIE0  0
+#define OCIE0  1
+#define TOIE1  2
+#define OCIE1B 3
+#define OCIE1A 4
+#define TICIE1 5
+#define TOIE2  6
+#define OCIE2  7
+#define TOV0   0
+#define OCF0   1
+#define TOV1   2
+#define OCF1B  3
+#define OCF1A  4
+#define ICF1   5
+#define TOV2   6
+#define OCF2   7
+
+/* TCCR0, TCCR2 */
+#define CS00  0
+#define CS01  1
+#define CS02  2
+#define WGM01 3
+#define COM00 4
+#define COM01 5
+#define WGM00 6
+#define FOC0  7
+#define CS20  0
+#define CS21  1
+#define CS22  2
+#define WGM21 3
+#define COM20 4
+#define COM21 5
+#define WGM20 6
+#define FOC2  7
+
+/* TCCR1A, TCCR1B */
+#define WGM10  0
+#define WGM11  1
+#define COM1A1 7
+#define CS10   0
+#define CS11   1
+#define CS12   2
+#define WGM12  3
+#define WGM13  4
+#define ICES1  6
+#define ICNC1  7
+
+/* TWCR, TWSR */
+#define TWIE  0
+#define TWEN  2
+#define TWWC  3
+#define TWSTO 4
+#define TWSTA 5
+#define TWEA  6
+#define TWINT 7
+#define TWPS0 0
+#define TWPS1 1
+
+/* UCSRA, UCSRB, UCSRC */
+#define MPCM  0
+#define U2X   1
+#define PE    2
+#define DOR   3
+#define FE    4
+#define UDRE  5
+#define TXC   6
+#define RXC   7
+#define TXB8  0
+#define RXB8  1
+#define UCSZ2 2
+#define TXEN  3
+#define RXEN  4
+#define UDRIE 5
+#define TXCIE 6
+#define RXCIE 7
+#define UCPOL 0
+#define UCSZ0 1
+#define UCSZ1 2
+#define USBS  3
+#define UPM0  4
+#define UPM1  5
+#define UMSEL 6
+#define URSEL 7
+
+/* EECR */
+#define EERE  0
+#define EEWE  1
+#define EEMWE 2
+#define EERIE 3
+
+#define E2END 0x1FF
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef SIM_AVR_PGMSPACE_H
+#define SIM_AVR_PGMSPACE_H
+
+/* Host stand in for <avr/pgmspace.h>, flash is ordinary memory */
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s)                 (s)
+#define pgm_read_byte(addr)     (*(const uint8_t *)(addr))
+#define pgm_read_word(addr)     (*(const uint16_t *)(addr))
+#define pgm_read_ptr(addr)      (*(void * const *)(addr))
+#define memcpy_P(dst, src, n)   memcpy((dst), (src), (n))
+
+#endif
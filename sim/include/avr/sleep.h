@@ -0,0 +1,19 @@
+#ifndef SIM_AVR_SLEEP_H
+#define SIM_AVR_SLEEP_H
+
+/*
+ * Host stand in for <avr/sleep.h>. Sleeping runs the simulator forward
+ * until an interrupt has been taken, the only thing that wakes the CPU
+ * from idle.
+ */
+
+#define SLEEP_MODE_IDLE         0
+
+#define set_sleep_mode(mode)    ((void)(mode))
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu()             sim_sleep()
+
+void sim_sleep(void);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef SIM_UTIL_ATOMIC_H
+#define SIM_UTIL_ATOMIC_H
+
+/*
+ * Host stand in for <util/atomic.h>. The simulator only runs ISRs while
+ * the main code is delayed or asleep, so a block is atomic already.
+ */
+
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+#define ATOMIC_BLOCK(type)  for (int sim_once = 1; sim_once; sim_once = 0)
+
+#endif
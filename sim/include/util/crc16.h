@@ -0,0 +1,16 @@
+#ifndef SIM_UTIL_CRC16_H
+#define SIM_UTIL_CRC16_H
+
+/* Host stand in for <util/crc16.h>, the same sums in plain C */
+
+#include <stdint.h>
+
+static inline uint8_t _crc_ibutton_update(uint8_t crc, uint8_t data)
+{
+    crc ^= data;
+    for (uint8_t i = 0; i < 8; i++)
+        crc = (crc & 0x01) ? (crc >> 1) ^ 0x8C : crc >> 1;
+    return crc;
+}
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef SIM_UTIL_DELAY_H
+#define SIM_UTIL_DELAY_H
+
+/* Host stand in for <util/delay.h>, a delay runs the simulator forward */
+
+void _delay_ms(double ms);
+void _delay_us(double us);
+
+#endif
@@ -0,0 +1,612 @@
+/*
+ * File:    sim.c
+ * Description: Host simulator core. Owns the register file, the virtual
+ *              clock, the timers, the platter and the interrupt dispatch.
+ *              See sim.h for how a run is configured.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include <util/delay.h>
+
+#include "constants.h"
+#include "sim.h"
+#include "sched.h"
+#include "stats.h"
+
+
+/* Register file */
+volatile uint8_t PORTA, PINA, DDRA;
+volatile uint8_t PORTB, PINB, DDRB;
+volatile uint8_t PORTC, PINC, DDRC;
+volatile uint8_t PORTD, PIND, DDRD;
+volatile uint8_t SREG, MCUCR, MCUCSR, GICR, GIFR, TIMSK, TIFR;
+volatile uint8_t TCCR0, TCNT0, OCR0;
+volatile uint8_t TCCR1A, TCCR1B;
+volatile uint8_t TCCR2, TCNT2, OCR2;
+volatile uint8_t TWBR, TWSR = 0xF8, TWAR, TWDR, TWCR;
+volatile uint8_t UCSRA, UCSRB, UCSRC, UBRRH, UBRRL, UDR;
+volatile uint8_t EECR, EEDR;
+volatile uint16_t TCNT1, OCR1A, OCR1B, ICR1, EEAR;
+
+/* Sectors the firmware is showing, see clock.c */
+extern sector_t gFrontSectors;
+extern sector_t gFrameLast;
+
+uint64_t gSimCycles = 0;
+uint64_t gSimEnd;
+
+/* Prescaler accumulators, in CPU cycles */
+uint32_t gSimT0Acc = 0;
+uint32_t gSimT1Acc = 0;
+uint32_t gSimT2Acc = 0;
+uint64_t gSimIsrs = 0;
+
+/* Platter */
+double gSimRps = TARGET_RPS;
+uint64_t gSimRevCycles;
+uint64_t gSimLastHall = 0;
+uint64_t gSimNextHall;
+uint32_t gSimRevolutions = 0;
+
+/*
+ * Motor, SIM_MOTOR. The speed the ESC pulse asks for is linear from
+ * standstill at SIM_MOTOR_ZERO_US up to gSimMotor RPS at 1200 us, and
+ * the platter gets there as a first order lag.
+ */
+#define SIM_MOTOR_ZERO_US   1000.0
+#define SIM_MOTOR_TAU       0.5     /* Seconds */
+#define SIM_RPS_MIN         1.0     /* No hall edges below this */
+double gSimMotor = 0;               /* 0 holds SIM_RPS instead */
+
+/*
+ * Sector ISRs per revolution, skipping the first two once the sector
+ * timer runs while it locks. Slot 0 starts on the hall capture, so a
+ * locked display takes FRAME_SIZE - 1 of them.
+ */
+uint32_t gSimSectorIsrs = 0;
+uint32_t gSimSectorRevs = 0;
+uint32_t gSimSectorMin = 0xFFFFFFFF;
+uint32_t gSimSectorMax = 0;
+
+/*
+ * LED state at the middle of each sector, last full revolution. That
+ * falls in the last BCM slot, so it is the top bit of each channel.
+ */
+uint8_t gSimSamples[RESOLUTION];
+uint8_t gSimImage[RESOLUTION];
+sector_t gSimSample = 0;
+
+/* Button presses */
+#define SIM_MAX_PRESSES 32
+#define SIM_PRESS_SECONDS 0.2
+struct
+{
+    uint64_t at;
+    uint64_t hold;
+    uint8_t pin;
+} gSimPresses[SIM_MAX_PRESSES];
+uint8_t gSimNumPresses = 0;
+
+/* EEPROM, a write started by EEWE takes SIM_EEPROM_WRITE_MS */
+#define SIM_EEPROM_WRITE_MS 8.5
+uint8_t gSimEeprom[E2END + 1];
+const char *gSimEepromFile = NULL;
+uint64_t gSimEepromDone = 0;        /* End of the write under way, or 0 */
+
+
+/*
+ * Function:    sim_flag_clear
+ * ---------------------------
+ *  Clears interrupt flags the way writing a 1 to TIFR or GIFR does.
+ */
+void sim_flag_clear(volatile uint8_t *reg, uint8_t mask)
+{
+    *reg &= ~mask;
+}
+
+
+/*
+ * Function:    prescaler
+ * ----------------------
+ *  Returns the CPU cycles per timer tick for the clock select bits of
+ *  TIMER 0 or TIMER 1, or 0 when the timer is stopped.
+ */
+uint32_t prescaler(uint8_t cs)
+{
+    static const uint32_t div[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+    return div[cs & 0x07];
+}
+
+
+/*
+ * Function:    prescaler2
+ * -----------------------
+ *  TIMER 2 has its own clock select table.
+ */
+uint32_t prescaler2(uint8_t cs)
+{
+    static const uint32_t div[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+    return div[cs & 0x07];
+}
+
+
+/*
+ * Function:    step_motor
+ * -----------------------
+ *  Moves the platter speed on by one PWM period, from the pulse that
+ *  went out in it, and moves the next hall edge to match. Fast PWM
+ *  pulses are OCR2 + 1 ticks long.
+ */
+void step_motor(void)
+{
+    double pulse = (OCR2 + 1) * (double)PWM_TICK_WIDTH;
+    double want = (pulse - SIM_MOTOR_ZERO_US) / (1200.0 - SIM_MOTOR_ZERO_US)
+                  * gSimMotor;
+    double dt = 256.0 * 1024 / F_CPU;
+
+    if (want < 0)
+        want = 0;
+    gSimRps += (want - gSimRps) * dt / SIM_MOTOR_TAU;
+
+    if (gSimRps < SIM_RPS_MIN)
+    {
+        gSimNextHall = UINT64_MAX;
+        return;
+    }
+    gSimRevCycles = (uint64_t)(F_CPU / gSimRps);
+    gSimNextHall = gSimLastHall + gSimRevCycles;
+    if (gSimNextHall < gSimCycles)
+        gSimNextHall = gSimCycles;
+}
+
+
+/*
+ * Function:    step_timers
+ * ------------------------
+ *  Advances TIMER 0 (normal or CTC), TIMER 1 (normal) and TIMER 2 (the
+ *  overflow of its PWM) by one step.
+ */
+void step_timers(void)
+{
+    uint32_t div = prescaler(TCCR0);
+    if (div)
+    {
+        gSimT0Acc += SIM_STEP;
+        while (gSimT0Acc >= div)
+        {
+            gSimT0Acc -= div;
+            /*
+             * The flag is raised as the match clears the counter, by
+             * the time the ISR runs the next sector is already counting.
+             */
+            if ((TCCR0 & (1 << WGM01)) && TCNT0 == OCR0)
+            {
+                TCNT0 = 0;
+                TIFR |= (1 << OCF0);
+            }
+            else if (++TCNT0 == 0)
+                TIFR |= (1 << TOV0);
+        }
+    }
+
+    div = prescaler(TCCR1B);
+    if (div)
+    {
+        gSimT1Acc += SIM_STEP;
+        while (gSimT1Acc >= div)
+        {
+            gSimT1Acc -= div;
+            if (++TCNT1 == 0)
+                TIFR |= (1 << TOV1);
+        }
+    }
+
+    div = prescaler2(TCCR2);
+    if (div)
+    {
+        gSimT2Acc += SIM_STEP;
+        while (gSimT2Acc >= div)
+        {
+            gSimT2Acc -= div;
+            if (++TCNT2 == 0)
+            {
+                TIFR |= (1 << TOV2);
+                if (gSimMotor)
+                    step_motor();
+            }
+        }
+    }
+}
+
+
+/*
+ * Function:    step_platter
+ * -------------------------
+ *  Raises the hall edge once per revolution, latching TIMER 1 into ICR1,
+ *  and samples the LEDs in the middle of every sector.
+ */
+void step_platter(void)
+{
+    if (gSimCycles >= gSimNextHall)
+    {
+        if (prescaler(TCCR1B))
+        {
+            ICR1 = TCNT1;
+            TIFR |= (1 << ICF1);
+        }
+
+        if (gSimSectorIsrs && ++gSimSectorRevs > 2)
+        {
+            if (gSimSectorIsrs < gSimSectorMin)
+                gSimSectorMin = gSimSectorIsrs;
+            if (gSimSectorIsrs > gSimSectorMax)
+                gSimSectorMax = gSimSectorIsrs;
+        }
+        if (gSimSample == RESOLUTION)
+            memcpy(gSimImage, gSimSamples, sizeof(gSimImage));
+
+        gSimRevolutions++;
+        gSimSectorIsrs = 0;
+        gSimSample = 0;
+        gSimLastHall = gSimNextHall;
+        gSimNextHall += gSimRevCycles;
+    }
+
+    while (gSimSample < RESOLUTION &&
+           gSimCycles - gSimLastHall >=
+           (2 * gSimSample + 1) * gSimRevCycles / (2 * RESOLUTION))
+    {
+        gSimSamples[gSimSample++] = PORTD & (WHITE);
+    }
+}
+
+
+/*
+ * Function:    step_eeprom
+ * ------------------------
+ *  Takes EEDR into EEAR once EEWE is set and holds EEWE until the write
+ *  time is up, as the part does.
+ */
+void step_eeprom(void)
+{
+    if (!(EECR & (1 << EEWE)))
+        return;
+
+    if (!gSimEepromDone)
+    {
+        gSimEeprom[EEAR & E2END] = EEDR;
+        gSimEepromDone = gSimCycles +
+                         (uint64_t)(SIM_EEPROM_WRITE_MS * (F_CPU / 1000));
+    }
+    else if (gSimCycles >= gSimEepromDone)
+    {
+        gSimEepromDone = 0;
+        EECR &= ~((1 << EEWE) | (1 << EEMWE));
+    }
+}
+
+
+/*
+ * Function:    step_buttons
+ * -------------------------
+ *  Buttons pull their pin low while pressed, the rest read the pullup.
+ */
+void step_buttons(void)
+{
+    uint8_t pressed = 0;
+
+    for (uint8_t i = 0; i < gSimNumPresses; i++)
+    {
+        if (gSimCycles >= gSimPresses[i].at &&
+            gSimCycles < gSimPresses[i].at + gSimPresses[i].hold)
+            pressed |= (1 << gSimPresses[i].pin);
+    }
+    PINA = PORTA & ~DDRA & ~pressed;
+}
+
+
+/*
+ * Function:    call_isr
+ * ---------------------
+ *  Runs an ISR with interrupts masked, as the hardware does.
+ */
+void call_isr(void (*isr)(void))
+{
+    gSimIsrs++;
+    SREG &= ~0x80;
+    isr();
+    SREG |= 0x80;
+}
+
+
+/*
+ * Function:    dispatch
+ * ---------------------
+ *  Calls the highest priority pending ISR, if interrupts are on.
+ *  Returns 1 if one ran. Flags the hardware clears on entry are cleared
+ *  here, TWINT, RXC and UDRE are left for the ISR like on the part.
+ */
+int dispatch(void)
+{
+    if (!(SREG & 0x80))
+        return 0;
+
+    if ((TIFR & (1 << TOV2)) && (TIMSK & (1 << TOIE2)) && TIMER2_OVF_vect)
+    {
+        TIFR &= ~(1 << TOV2);
+        call_isr(TIMER2_OVF_vect);
+        return 1;
+    }
+    if ((TIFR & (1 << ICF1)) && (TIMSK & (1 << TICIE1)) && TIMER1_CAPT_vect)
+    {
+        TIFR &= ~(1 << ICF1);
+        call_isr(TIMER1_CAPT_vect);
+        return 1;
+    }
+    if ((TIFR & (1 << TOV1)) && (TIMSK & (1 << TOIE1)) && TIMER1_OVF_vect)
+    {
+        TIFR &= ~(1 << TOV1);
+        call_isr(TIMER1_OVF_vect);
+        return 1;
+    }
+    if ((UCSRA & (1 << RXC)) && (UCSRB & (1 << RXCIE)) && USART_RXC_vect)
+    {
+        call_isr(USART_RXC_vect);
+        return 1;
+    }
+    if ((UCSRA & (1 << UDRE)) && (UCSRB & (1 << UDRIE)) && USART_UDRE_vect)
+    {
+        call_isr(USART_UDRE_vect);
+        return 1;
+    }
+    if (!(EECR & (1 << EEWE)) && (EECR & (1 << EERIE)) && EE_RDY_vect)
+    {
+        call_isr(EE_RDY_vect);
+        return 1;
+    }
+    if ((TWCR & (1 << TWINT)) && (TWCR & (1 << TWIE)) && TWI_vect)
+    {
+        call_isr(TWI_vect);
+        return 1;
+    }
+    if ((GIFR & (1 << INTF2)) && (GICR & (1 << INT2)) && INT2_vect)
+    {
+        GIFR &= ~(1 << INTF2);
+        call_isr(INT2_vect);
+        return 1;
+    }
+    if ((TIFR & (1 << OCF0)) && (TIMSK & (1 << OCIE0)) && TIMER0_COMP_vect)
+    {
+        TIFR &= ~(1 << OCF0);
+        gSimSectorIsrs++;
+        call_isr(TIMER0_COMP_vect);
+        return 1;
+    }
+    return 0;
+}
+
+
+/*
+ * Function:    sim_report
+ * -----------------------
+ *  Prints what the run did and saves the EEPROM.
+ */
+void sim_report(void)
+{
+    static const char names[8] = {'.', 'R', 'B', 'P', 'G', 'Y', 'C', 'W'};
+    char time[12];
+
+    sim_uart_flush();
+    ds1307_time(time);
+    printf("sim: %.3f s, %u revolutions at %.2f RPS\n",
+           (double)gSimCycles / F_CPU, gSimRevolutions, gSimRps);
+    printf("sim: sector ISRs per revolution %u..%u, expect FRAME_SIZE - 1 = %u\n",
+           gSimSectorMax ? gSimSectorMin : 0, gSimSectorMax, FRAME_SIZE - 1);
+    if (gFrontSectors != RESOLUTION)
+        printf("sim: shown in %u sectors, expect %u\n",
+               gFrontSectors, gFrameLast);
+    printf("sim: DS1307 time %s\n", time);
+    printf("sim: last revolution from 12 o'clock, "
+           ". off, R red, G green, B blue, C cyan, P purple, Y yellow, W white\n");
+    for (sector_t i = 0; i < RESOLUTION; i++)
+    {
+        putchar(names[(gSimImage[i] >> RED_LED) & 0x07]);
+        if (i % 60 == 59)
+            putchar('\n');
+    }
+
+#ifdef STATS
+    Stats stats;
+    stats_snapshot(&stats);
+    printf("stats: %u revolutions, period %u..%u mean %lu ticks\n",
+           stats.revolutions, stats.period_min, stats.period_max,
+           (unsigned long)(stats.period_mean >> STATS_MEAN_SHIFT));
+    printf("stats: sector ISRs last %u, %u..%u, %u short, %u long\n",
+           stats.slots_last, stats.slots_min, stats.slots_max,
+           stats.short_revs, stats.long_revs);
+    printf("stats: sector OCR history");
+    for (uint8_t i = 0; i < STATS_HISTORY; i++)
+        printf(" %u", stats.ocr_history[(stats.ocr_next + i) & (STATS_HISTORY - 1)]);
+    printf("\nstats: latency capture %u, sector %u %u %u %u ticks "
+           "at F_CPU / 8 64 256 1024, loop %u max %u ticks\n",
+           stats.capture_latency_max, stats.sector_latency_max[0],
+           stats.sector_latency_max[1], stats.sector_latency_max[2],
+           stats.sector_latency_max[3], stats.loop_last, stats.loop_max);
+    for (uint8_t i = 0; i < gNumTasks; i++)
+        printf("stats: task %u late max %u ticks, run max %u ticks\n",
+               i, gTasks[i].late_max, gTasks[i].run_max);
+#endif
+
+    if (gSimEepromFile)
+    {
+        FILE *f = fopen(gSimEepromFile, "wb");
+        if (f)
+        {
+            fwrite(gSimEeprom, 1, sizeof(gSimEeprom), f);
+            fclose(f);
+        }
+    }
+}
+
+
+/*
+ * Function:    sim_run
+ * --------------------
+ *  Runs the hardware forward, calling ISRs as their flags come up.
+ *  Ends the program once SIM_SECONDS of virtual time have passed.
+ */
+void sim_run(uint64_t cycles)
+{
+    uint64_t end = gSimCycles + cycles;
+
+    while (gSimCycles < end)
+    {
+        gSimCycles += SIM_STEP;
+        step_timers();
+        step_platter();
+        step_buttons();
+        step_eeprom();
+        ds1307_step();
+        sim_uart_step();
+        while (dispatch());
+
+        if (gSimCycles >= gSimEnd)
+        {
+            sim_report();
+            exit(0);
+        }
+    }
+}
+
+
+/*
+ * Function:    sim_sleep
+ * ----------------------
+ *  Idle sleep, runs until the next interrupt has been taken.
+ */
+void sim_sleep(void)
+{
+    uint64_t isrs = gSimIsrs;
+
+    while (gSimIsrs == isrs)
+        sim_run(SIM_STEP);
+}
+
+
+void _delay_ms(double ms)
+{
+    sim_run((uint64_t)(ms * (F_CPU / 1000)));
+}
+
+
+void _delay_us(double us)
+{
+    sim_run((uint64_t)(us * (F_CPU / 1000000)));
+}
+
+
+uint8_t eeprom_read_byte(const uint8_t *addr)
+{
+    return gSimEeprom[(uintptr_t)addr & E2END];
+}
+
+
+void eeprom_write_byte(uint8_t *addr, uint8_t value)
+{
+    gSimEeprom[(uintptr_t)addr & E2END] = value;
+}
+
+
+void eeprom_update_byte(uint8_t *addr, uint8_t value)
+{
+    eeprom_write_byte(addr, value);
+}
+
+
+void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        ((uint8_t *)dst)[i] = eeprom_read_byte((const uint8_t *)src + i);
+}
+
+
+/*
+ * Function:    sim_init
+ * ---------------------
+ *  Reads the run configuration from the environment before the
+ *  firmware's main starts.
+ */
+__attribute__((constructor))
+void sim_init(void)
+{
+    const char *env;
+
+    if (getenv("SIM_CHECK"))
+        exit(sim_check_hands());
+
+    env = getenv("SIM_SECONDS");
+    gSimEnd = (uint64_t)((env ? atof(env) : 12.0) * F_CPU);
+
+    env = getenv("SIM_MOTOR");
+    if (env)
+    {
+        gSimMotor = atof(env);
+        gSimRps = 0;
+    }
+    env = getenv("SIM_RPS");
+    if (env)
+        gSimRps = atof(env);
+    if (gSimRps < SIM_RPS_MIN)
+    {
+        gSimRevCycles = F_CPU;
+        gSimNextHall = UINT64_MAX;
+    }
+    else
+    {
+        gSimRevCycles = (uint64_t)(F_CPU / gSimRps);
+        gSimNextHall = gSimRevCycles;
+    }
+
+    ds1307_init(getenv("SIM_TIME"), getenv("SIM_RTC_PPM"),
+                getenv("SIM_RTC_LOST"));
+    sim_uart_init(getenv("SIM_UART"));
+
+    env = getenv("SIM_BUTTONS");
+    while (env && *env && gSimNumPresses < SIM_MAX_PRESSES)
+    {
+        double at, hold = SIM_PRESS_SECONDS;
+        int button, used;
+        if (sscanf(env, "%lf:%d%n", &at, &button, &used) != 2 ||
+            button < 1 || button > NUM_BUTTONS)
+            break;
+        env += used;
+        if (*env == ':' && sscanf(env, ":%lf%n", &hold, &used) == 1)
+            env += used;
+        gSimPresses[gSimNumPresses].at = (uint64_t)(at * F_CPU);
+        gSimPresses[gSimNumPresses].hold = (uint64_t)(hold * F_CPU);
+        gSimPresses[gSimNumPresses].pin = BUTTON1 + button - 1;
+        gSimNumPresses++;
+        if (*env == ',')
+            env++;
+    }
+
+    /* Starts erased, like a fresh part */
+    memset(gSimEeprom, 0xFF, sizeof(gSimEeprom));
+    gSimEepromFile = getenv("SIM_EEPROM");
+    if (gSimEepromFile)
+    {
+        FILE *f = fopen(gSimEepromFile, "rb");
+        if (f)
+        {
+            if (fread(gSimEeprom, 1, sizeof(gSimEeprom), f) == 0)
+                memset(gSimEeprom, 0xFF, sizeof(gSimEeprom));
+            fclose(f);
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef SIM_H
+#define SIM_H
+
+/*
+ * Host simulator for the clock firmware, built with: make sim
+ *
+ * The firmware sources are compiled natively against the headers in
+ * sim/include. Time is virtual, counted in CPU cycles, and only moves
+ * when the firmware waits (_delay_ms). While it moves the simulator
+ * steps the timers, the spinning platter and the DS1307, and calls any
+ * ISR whose flag and enable are both set, in ATmega16 vector order.
+ *
+ * The run is configured from the environment:
+ *  SIM_SECONDS -- virtual seconds to run for (default 12, the ESC arms
+ *                 for the first 7)
+ *  SIM_RPS     -- platter speed in revolutions per second (TARGET_RPS),
+ *                 held, or the starting speed with SIM_MOTOR
+ *  SIM_MOTOR   -- drive the platter from the ESC pulse instead, at this
+ *                 many RPS for a 1200 us pulse (starts stopped)
+ *  SIM_TIME    -- DS1307 start time as HH:MM:SS (default 10:10:00)
+ *  SIM_RTC_PPM -- how many ppm fast the DS1307 crystal runs against the
+ *                 CPU one (default 0)
+ *  SIM_RTC_LOST -- seconds from which the DS1307 stops answering on the
+ *                 bus and its SQW/OUT stays quiet
+ *  SIM_BUTTONS -- presses as seconds:button, optionally :seconds held
+ *                 (default 0.2), eg: 1.5:1,2.0:3,3.0:2:1.5
+ *  SIM_EEPROM  -- file the 512 byte EEPROM is loaded from and saved to,
+ *                 without it the EEPROM starts erased
+ *  SIM_UART    -- file of lines sent to the USART, each as seconds then
+ *                 the text, eg: 8.0 T 12:34:56. What the firmware sends
+ *                 back is printed as uart: lines
+ *  SIM_CHECK   -- set to only check the hand positions against the
+ *                 float routines they replaced and exit, make sim runs
+ *                 this after the build
+ */
+
+#include <stdint.h>
+
+/* CPU cycles per simulator step */
+#define SIM_STEP 8
+
+extern uint64_t gSimCycles;
+
+void sim_run(uint64_t cycles);
+void sim_flag_clear(volatile uint8_t *reg, uint8_t mask);
+
+/* TWI master with a DS1307 on the bus, sim/ds1307.c */
+void sim_twcr_write(uint8_t value);
+void ds1307_init(const char *time, const char *ppm, const char *lost);
+void ds1307_step(void);
+void ds1307_time(char *buf);
+
+/* USART and the host on the line, sim/uart.c */
+uint8_t sim_udr_read(void);
+void sim_udr_write(uint8_t value);
+void sim_uart_init(const char *path);
+void sim_uart_step(void);
+void sim_uart_flush(void);
+
+/* Hand position check, sim/hands.c */
+int sim_check_hands(void);
+
+#endif
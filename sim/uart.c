@@ -0,0 +1,180 @@
+/*
+ * File:    uart.c
+ * Description: Simulated USART and the host on the other end of the
+ *              line. Bytes take ten bit times each way at the baud rate
+ *              the firmware set in UBRR. What the firmware sends is
+ *              printed a line at a time, what it receives comes from the
+ *              SIM_UART script.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <avr/io.h>
+
+#include "sim.h"
+
+#define SIM_UART_LINES  32
+#define SIM_UART_TEXT   64
+
+/* Script of lines sent to the firmware, each at its own time */
+struct
+{
+    uint64_t at;
+    char text[SIM_UART_TEXT];
+} gSimUartScript[SIM_UART_LINES];
+uint8_t gSimUartLines = 0;
+uint8_t gSimUartLine = 0;
+uint8_t gSimUartChar = 0;
+uint64_t gSimUartRxAt = 0;
+uint8_t gSimUartRxData;
+
+uint8_t gSimUartTxBusy = 0;
+uint64_t gSimUartTxDoneAt;
+char gSimUartOut[SIM_UART_TEXT];
+uint8_t gSimUartOutLen = 0;
+
+
+/*
+ * Function:    byte_cycles
+ * ------------------------
+ *  CPU cycles one 8N1 byte takes on the line at the current UBRR.
+ */
+uint64_t byte_cycles(void)
+{
+    uint16_t ubrr = ((UBRRH & 0x0F) << 8) | UBRRL;
+    return 10 * 16 * (uint64_t)(ubrr + 1);
+}
+
+
+/*
+ * Function:    sim_udr_read
+ * -------------------------
+ *  Firmware read of UDR, takes the received byte and clears RXC.
+ */
+uint8_t sim_udr_read(void)
+{
+    UCSRA &= ~((1 << RXC) | (1 << DOR));
+    return gSimUartRxData;
+}
+
+
+/*
+ * Function:    sim_udr_write
+ * --------------------------
+ *  Firmware write of UDR, starts sending the byte if the transmitter is
+ *  on. UDRE stays clear until it is on the line.
+ */
+void sim_udr_write(uint8_t value)
+{
+    if (!(UCSRB & (1 << TXEN)))
+        return;
+
+    UDR = value;
+    UCSRA &= ~(1 << UDRE);
+    gSimUartTxBusy = 1;
+    gSimUartTxDoneAt = gSimCycles + byte_cycles();
+}
+
+
+/*
+ * Function:    print_line
+ * -----------------------
+ *  Prints what the firmware has sent since the last newline.
+ */
+void print_line(void)
+{
+    gSimUartOut[gSimUartOutLen] = '\0';
+    printf("uart: %s\n", gSimUartOut);
+    gSimUartOutLen = 0;
+}
+
+
+/*
+ * Function:    sim_uart_step
+ * --------------------------
+ *  Finishes the byte being sent and delivers the next script byte once
+ *  the receiver is on. A byte that arrives with RXC still set is lost,
+ *  as on the part.
+ */
+void sim_uart_step(void)
+{
+    if (gSimUartTxBusy && gSimCycles >= gSimUartTxDoneAt)
+    {
+        gSimUartTxBusy = 0;
+        UCSRA |= (1 << UDRE) | (1 << TXC);
+        if (UDR == '\n')
+            print_line();
+        else if (UDR != '\r' && gSimUartOutLen < SIM_UART_TEXT - 1)
+            gSimUartOut[gSimUartOutLen++] = UDR;
+    }
+
+    if (gSimUartLine >= gSimUartLines || !(UCSRB & (1 << RXEN)))
+        return;
+    if (gSimCycles < gSimUartScript[gSimUartLine].at || gSimCycles < gSimUartRxAt)
+        return;
+
+    const char *text = gSimUartScript[gSimUartLine].text;
+    if (UCSRA & (1 << RXC))
+        UCSRA |= (1 << DOR);
+    else
+    {
+        gSimUartRxData = text[gSimUartChar] ? text[gSimUartChar] : '\n';
+        UCSRA |= (1 << RXC);
+    }
+
+    gSimUartRxAt = gSimCycles + byte_cycles();
+    if (!text[gSimUartChar++])
+    {
+        gSimUartLine++;
+        gSimUartChar = 0;
+    }
+}
+
+
+/*
+ * Function:    sim_uart_init
+ * --------------------------
+ *  Loads the SIM_UART script, one line per command as seconds followed
+ *  by the text, eg: 8.0 T 12:34:56
+ */
+void sim_uart_init(const char *path)
+{
+    UCSRA = (1 << UDRE);
+    if (!path)
+        return;
+
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        perror(path);
+        return;
+    }
+
+    char line[SIM_UART_TEXT + 16];
+    while (gSimUartLines < SIM_UART_LINES && fgets(line, sizeof(line), f))
+    {
+        double at;
+        int used;
+        if (sscanf(line, "%lf %n", &at, &used) != 1)
+            continue;
+        line[strcspn(line, "\r\n")] = '\0';
+        gSimUartScript[gSimUartLines].at = (uint64_t)(at * F_CPU);
+        snprintf(gSimUartScript[gSimUartLines].text, SIM_UART_TEXT, "%s",
+                 line + used);
+        gSimUartLines++;
+    }
+    fclose(f);
+}
+
+
+/*
+ * Function:    sim_uart_flush
+ * ---------------------------
+ *  Prints a partly sent line at the end of a run.
+ */
+void sim_uart_flush(void)
+{
+    if (gSimUartOutLen)
+        print_line();
+}
@@ -0,0 +1,248 @@
+/*
+ * File:    stats.c
+ * Description: Running display timing figures, see stats.h. Only built
+ *              into the firmware with STATS defined.
+ */
+
+#ifdef STATS
+
+#include <avr/io.h>
+#include <util/atomic.h>
+
+#include "sched.h"
+#include "stats.h"
+#include "uart.h"
+
+volatile Stats gStats;
+Stats gStatsOut;                        /* Snapshot a dump is sending */
+uint8_t gStatsSend = 0;                 /* Lines of a dump still to go */
+
+
+/*
+ * Function:    stats_reset
+ * ------------------------
+ *  Clears every figure, the minimums start from their largest value so
+ *  the first sample replaces them.
+ *
+ *  Modifies: gStats
+ */
+void stats_reset(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        uint8_t *p = (uint8_t *)&gStats;
+        for (uint8_t i = 0; i < sizeof(Stats); i++)
+            p[i] = 0;
+        gStats.period_min = 0xFFFF;
+        gStats.slots_min = (sector_t)~0;
+    }
+}
+
+
+/*
+ * Function:    stats_snapshot
+ * ---------------------------
+ *  Copies the figures out in one go, so they all belong to the same
+ *  moment even with the ISRs still updating them.
+ *
+ *  Modifies: out
+ */
+void stats_snapshot(Stats *out)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        const volatile uint8_t *src = (const volatile uint8_t *)&gStats;
+        uint8_t *dst = (uint8_t *)out;
+        for (uint8_t i = 0; i < sizeof(Stats); i++)
+            dst[i] = src[i];
+    }
+}
+
+
+/*
+ * Function:    stats_capture
+ * --------------------------
+ *  Called at the start of the hall capture with the number of sector
+ *  ISRs the revolution just finished took, how many a locked display
+ *  takes for the frame it showed and how late the capture ISR started.
+ *  That is one less than the slots in the frame, slot 0 is started by
+ *  the capture itself. The first capture ends no
+ *  revolution and only counts.
+ *
+ *  Modifies: gStats
+ */
+void stats_capture(sector_t slots, sector_t expected, uint8_t latency)
+{
+    if (latency > gStats.capture_latency_max)
+        gStats.capture_latency_max = latency;
+
+    if (gStats.revolutions < 0xFFFF)
+        gStats.revolutions++;
+    if (gStats.revolutions == 1)
+        return;
+
+    gStats.slots_last = slots;
+    if (slots < gStats.slots_min)
+        gStats.slots_min = slots;
+    if (slots > gStats.slots_max)
+        gStats.slots_max = slots;
+    if (slots < expected && gStats.short_revs < 0xFFFF)
+        gStats.short_revs++;
+    if (slots > expected && gStats.long_revs < 0xFFFF)
+        gStats.long_revs++;
+}
+
+
+/*
+ * Function:    stats_period
+ * -------------------------
+ *  Called later in the hall capture with the measured period and the
+ *  sector OCR picked for the coming revolution.
+ *
+ *  Modifies: gStats
+ */
+void stats_period(uint16_t period, uint8_t ocr)
+{
+    gStats.ocr_history[gStats.ocr_next] = ocr;
+    gStats.ocr_next = (gStats.ocr_next + 1) & (STATS_HISTORY - 1);
+
+    if (gStats.revolutions < 2)
+        return;
+
+    if (period < gStats.period_min)
+        gStats.period_min = period;
+    if (period > gStats.period_max)
+        gStats.period_max = period;
+    if (gStats.revolutions == 2)
+        gStats.period_mean = (uint32_t)period << STATS_MEAN_SHIFT;
+    else
+        gStats.period_mean += period - (gStats.period_mean >> STATS_MEAN_SHIFT);
+}
+
+
+/*
+ * Function:    stats_loop
+ * -----------------------
+ *  Records how long one pass of the main loop took to do its work.
+ *
+ *  Modifies: gStats
+ */
+void stats_loop(uint16_t ticks)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        gStats.loop_last = ticks;
+        if (ticks > gStats.loop_max)
+            gStats.loop_max = ticks;
+    }
+}
+
+
+/*
+ * Function:    stats_dump
+ * -----------------------
+ *  Takes a snapshot of the figures and clears them, so the next dump
+ *  covers what happened from here on. stats_send sends the snapshot.
+ *
+ *  Modifies: gStatsOut, gStatsSend, gStats
+ */
+void stats_dump(void)
+{
+    stats_snapshot(&gStatsOut);
+    stats_reset();
+    gStatsSend = STATS_LINES + gNumTasks;
+}
+
+
+/*
+ * Function:    stats_send
+ * -----------------------
+ *  Sends the next line of a dump, then OK after the last:
+ *      I P <revolutions> <period min> <period max> <period mean>
+ *      I S <sector ISRs last> <min> <max> <short revs> <long revs>
+ *      I O <sector OCRs, oldest first>
+ *      I L <capture latency> <sector latency for each TIMER 0 clock>
+ *          <loop last> <loop max>
+ *      I T <task> <late max> <run max>, for every task
+ *  A task's maxima are cleared as its line goes. One line a call so the
+ *  UART ring never overflows. Returns 0 once there is nothing left to
+ *  send.
+ *
+ *  Modifies: gStatsSend, gTasks
+ */
+uint8_t stats_send(void)
+{
+    const Stats *s = &gStatsOut;
+    uint8_t i;
+
+    if (!gStatsSend)
+        return 0;
+
+    switch (STATS_LINES + gNumTasks - gStatsSend)
+    {
+    case 0:
+        uart_puts("I P ");
+        uart_put_uint(s->revolutions);
+        uart_write(' ');
+        uart_put_uint(s->period_min);
+        uart_write(' ');
+        uart_put_uint(s->period_max);
+        uart_write(' ');
+        uart_put_uint(s->period_mean >> STATS_MEAN_SHIFT);
+        break;
+    case 1:
+        uart_puts("I S ");
+        uart_put_uint(s->slots_last);
+        uart_write(' ');
+        uart_put_uint(s->slots_min);
+        uart_write(' ');
+        uart_put_uint(s->slots_max);
+        uart_write(' ');
+        uart_put_uint(s->short_revs);
+        uart_write(' ');
+        uart_put_uint(s->long_revs);
+        break;
+    case 2:
+        uart_puts("I O");
+        for (i = 0; i < STATS_HISTORY; i++)
+        {
+            uart_write(' ');
+            uart_put_uint(s->ocr_history[(s->ocr_next + i) &
+                                         (STATS_HISTORY - 1)]);
+        }
+        break;
+    case 3:
+        uart_puts("I L ");
+        uart_put_uint(s->capture_latency_max);
+        for (i = 0; i < STATS_CLOCKS; i++)
+        {
+            uart_write(' ');
+            uart_put_uint(s->sector_latency_max[i]);
+        }
+        uart_write(' ');
+        uart_put_uint(s->loop_last);
+        uart_write(' ');
+        uart_put_uint(s->loop_max);
+        break;
+    default:
+        i = gNumTasks - gStatsSend;
+        uart_puts("I T ");
+        uart_put_uint(i);
+        uart_write(' ');
+        uart_put_uint(gTasks[i].late_max);
+        uart_write(' ');
+        uart_put_uint(gTasks[i].run_max);
+        gTasks[i].late_max = 0;
+        gTasks[i].run_max = 0;
+        break;
+    }
+    uart_puts("\r\n");
+
+    if (--gStatsSend)
+        return 1;
+
+    uart_puts("OK\r\n");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef STATS_H
+#define STATS_H
+
+/*
+ * Display timing instrumentation.
+ *
+ * Built with STATS defined (make STATS=1) the ISRs and the main loop
+ * feed the running figures below, and the I command sends them and the
+ * scheduler task maxima and clears them. Without it every STATS_ macro
+ * is empty and none of this takes any flash, SRAM or cycles.
+ *
+ * Times are TIMER 1 ticks, F_CPU / 8, 0.5 us at 16 MHz. The sector
+ * latency is in TIMER 0 ticks, and TIMER 0 changes clock with the
+ * platter speed, so there is a maximum for each clock select, in order
+ * F_CPU / 8, 64, 256 and 1024, ticks of 0.5, 4, 16 and 64 us.
+ */
+
+#include <stdint.h>
+#include <avr/io.h>
+
+#include "constants.h"
+
+/* Number of past sector OCR values kept, must be a power of 2 */
+#define STATS_HISTORY       8
+
+/* The mean period is a moving average over about 2^STATS_MEAN_SHIFT */
+#define STATS_MEAN_SHIFT    4
+
+/* TIMER 0 clock selects, SECTOR_CLOCK_8 to SECTOR_CLOCK_1024 */
+#define STATS_CLOCKS        4
+
+/* Lines an I dump sends before the one for each task */
+#define STATS_LINES         4
+
+typedef struct Stats
+{
+    uint16_t revolutions;       /* Captures seen, saturates */
+    uint16_t period_min;
+    uint16_t period_max;
+    uint32_t period_mean;       /* Scaled up by 2^STATS_MEAN_SHIFT */
+
+    sector_t slots_last;        /* Sector ISRs in the last revolution */
+    sector_t slots_min;
+    sector_t slots_max;
+    uint16_t short_revs;        /* Revolutions with sectors missed */
+    uint16_t long_revs;         /* Revolutions that ran past the frame */
+
+    uint8_t ocr_history[STATS_HISTORY];     /* Oldest at ocr_next */
+    uint8_t ocr_next;
+
+    uint8_t capture_latency_max;    /* Hall edge to TIMER1_CAPT_vect */
+    uint8_t sector_latency_max[STATS_CLOCKS];   /* Compare match to */
+                                                /* TIMER0_COMP_vect  */
+
+    uint16_t loop_last;         /* Main loop work, without the delay */
+    uint16_t loop_max;
+} Stats;
+
+#ifdef STATS
+
+extern volatile Stats gStats;
+
+void stats_reset(void);
+void stats_snapshot(Stats *out);
+void stats_capture(sector_t slots, sector_t expected, uint8_t latency);
+void stats_period(uint16_t period, uint8_t ocr);
+void stats_loop(uint16_t ticks);
+void stats_dump(void);
+uint8_t stats_send(void);
+
+#define STATS_RESET()                   stats_reset()
+#define STATS_CAPTURE(slots, expected, latency) \
+    stats_capture((slots), (expected), (latency))
+#define STATS_PERIOD(period, ocr)       stats_period((period), (ocr))
+#define STATS_SECTOR_LATENCY() \
+    do { uint8_t stats_ticks = TCNT0; \
+         volatile uint8_t *stats_max = \
+             &gStats.sector_latency_max[gSectorClock - SECTOR_CLOCK_8]; \
+         if (stats_ticks > *stats_max) \
+             *stats_max = stats_ticks; } while (0)
+#define STATS_LOOP_START()  uint16_t stats_loop_start = TCNT1
+#define STATS_LOOP_END()    stats_loop(TCNT1 - stats_loop_start)
+
+#else
+
+#define STATS_RESET()
+#define STATS_CAPTURE(slots, expected, latency)
+#define STATS_PERIOD(period, ocr)
+#define STATS_SECTOR_LATENCY()
+#define STATS_LOOP_START()
+#define STATS_LOOP_END()
+
+#endif
+
+#endif
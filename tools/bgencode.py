@@ -0,0 +1,213 @@
+#!/usr/bin/env python3
+"""
+Encodes background artwork into the palette indexed run tables in
+backgrounds.h.
+
+Usage: tools/bgencode.py backgrounds.txt > backgrounds.h
+
+Each non blank line that is not a # comment of the input is one background, a list
+of colors with an optional *N repeat count. A color is one of the
+RGB_ names in constants.h without the prefix, or #RGB with one hex
+digit per channel. Adjacent runs of the same color are merged.
+
+Each background uses up to PALETTE_SIZE colors, and every run is
+packed into a byte: the index into the background's palette in the top
+3 bits and the length in the low 5. A run longer than 31 sectors has 0
+there and its length in the next byte, and runs longer than 255 sectors
+are split.
+
+All the palettes are windows into one shared color table, and the
+colors of a palette can be in any order, so a background whose colors
+sit next to each other anywhere in the table, a one color one always,
+costs nothing there. Backgrounds with the same runs share them too.
+"""
+
+import re
+import sys
+
+BACKGROUND_RESOLUTION = 180
+PALETTE_SIZE = 8
+INDEX_SHIFT = 5
+LENGTH_MASK = (1 << INDEX_SHIFT) - 1
+COLORS = {"OFF": 0x000, "RED": 0xF00, "GREEN": 0x0F0, "BLUE": 0x00F,
+          "CYAN": 0x0FF, "PURPLE": 0xF0F, "YELLOW": 0xFF0, "WHITE": 0xFFF}
+NAMES = {value: "RGB_" + name for name, value in COLORS.items()}
+HEX = re.compile(r"^#[0-9a-fA-F]{3}$")
+
+
+def color_value(color):
+    if HEX.match(color):
+        return int(color[1:], 16)
+    return COLORS.get(color)
+
+
+def color_text(value):
+    return NAMES.get(value, "0x%03X" % value)
+
+
+def parse_line(line, lineno):
+    runs = []
+    for token in line.split():
+        color, _, count = token.partition("*")
+        color = color_value(color)
+        if color is None:
+            sys.exit("line %d: unknown color '%s'" % (lineno, token))
+        count = int(count) if count else 1
+        if runs and runs[-1][1] == color:
+            runs[-1][0] += count
+        else:
+            runs.append([count, color])
+
+    total = sum(length for length, _ in runs)
+    if total != BACKGROUND_RESOLUTION:
+        sys.exit("line %d: %d sectors, expected %d"
+                 % (lineno, total, BACKGROUND_RESOLUTION))
+
+    colors = []
+    for _, color in runs:
+        if color not in colors:
+            colors.append(color)
+    if len(colors) > PALETTE_SIZE:
+        sys.exit("line %d: %d colors, a palette holds %d"
+                 % (lineno, len(colors), PALETTE_SIZE))
+    return colors, runs
+
+
+def pack_runs(runs, palette):
+    packed = []
+    for length, color in runs:
+        index = palette.index(color)
+        while length > 0:
+            part = min(length, 255)
+            if part <= LENGTH_MASK:
+                packed.append(("BG_RUN(%d, %d)" % (index, part), 1))
+            else:
+                packed.append(("BG_LONG(%d), %d" % (index, part), 2))
+            length -= part
+    return packed
+
+
+def find(store, colors):
+    """Offset of a window of store holding just colors, or None."""
+    for at in range(len(store) - len(colors) + 1):
+        if set(store[at:at + len(colors)]) == set(colors):
+            return at
+    return None
+
+
+def overlap(part, colors):
+    return len(set(part)) == len(part) and set(part) <= set(colors)
+
+
+def pack_palettes(palettes):
+    """Lays the palettes out in one table, longest first so the shorter
+    ones can be found inside them. A palette that is not there already
+    goes on whichever end of the table has more of its colors, and its
+    new colors are ordered so the ones other palettes use too are next
+    to the colors it shares. Returns the table and each offset."""
+    store = []
+    order = sorted(palettes, key=len, reverse=True)
+    for n, colors in enumerate(order):
+        if find(store, colors) is not None:
+            continue
+        later = [p for p in order[n + 1:] if len(p) > 1]
+        shared = lambda c: sum(c in p for p in later)
+
+        head = tail = 0
+        for k in range(min(len(store), len(colors)), 0, -1):
+            if not tail and overlap(store[-k:], colors):
+                tail = k
+            if not head and overlap(store[:k], colors):
+                head = k
+        if tail >= head:
+            new = [c for c in colors if c not in store[len(store) - tail:]]
+            store = store + sorted(new, key=shared, reverse=True)
+        else:
+            new = [c for c in colors if c not in store[:head]]
+            store = sorted(new, key=shared) + store
+    return store, [find(store, colors) for colors in palettes]
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(__doc__.strip())
+
+    backgrounds = []
+    with open(sys.argv[1]) as f:
+        for lineno, line in enumerate(f, 1):
+            line = line.strip()
+            first = line.split()[0].partition("*")[0] if line else ""
+            if line and not (line.startswith("#") and not HEX.match(first)):
+                backgrounds.append(parse_line(line, lineno))
+
+    out = sys.stdout
+    out.write("/* Generated by tools/bgencode.py from backgrounds.txt, "
+              "do not edit. */\n\n")
+    out.write("#ifndef BACKGROUNDS_H\n#define BACKGROUNDS_H\n\n")
+    out.write("#include <avr/pgmspace.h>\n\n")
+    out.write("#include \"constants.h\"\n\n")
+    out.write("/* Backgrounds are drawn at %d sectors and scaled to "
+              "RESOLUTION */\n" % BACKGROUND_RESOLUTION)
+    out.write("#define BACKGROUND_RESOLUTION %d\n" % BACKGROUND_RESOLUTION)
+    out.write("#define NUM_BACKGROUNDS       %d\n\n" % len(backgrounds))
+    out.write("/*\n"
+              " * A run is a byte, the index into the background's palette in the\n"
+              " * top 3 bits and its length in the low %d, or 0 there and the length\n"
+              " * in the next byte.\n"
+              " */\n" % INDEX_SHIFT)
+    out.write("#define BG_INDEX_SHIFT        %d\n" % INDEX_SHIFT)
+    out.write("#define BG_LENGTH_MASK        0x%02X\n" % LENGTH_MASK)
+    out.write("#define BG_RUN(index, length) "
+              "((index) << BG_INDEX_SHIFT | (length))\n")
+    out.write("#define BG_LONG(index)        BG_RUN(index, 0)\n\n")
+    out.write("typedef struct Background\n{\n"
+              "    uint8_t runs;               /* First in gBackgroundRuns */\n"
+              "    uint8_t palette;            /* First in gBackgroundPalette */\n"
+              "} Background;\n\n")
+
+    store, offsets = pack_palettes([colors for colors, _ in backgrounds])
+    if len(store) > 256:
+        sys.exit("%d palette colors, at most 256 fit" % len(store))
+
+    entries = []
+    runs = []
+    runs_at = {}
+    size = 0
+    for (colors, bg_runs), palette_at in zip(backgrounds, offsets):
+        palette = store[palette_at:palette_at + len(colors)]
+        packed = tuple(pack_runs(bg_runs, palette))
+        if packed not in runs_at:
+            runs_at[packed] = size
+            runs.append(packed)
+            size += sum(length for _, length in packed)
+        entries.append((runs_at[packed], palette_at))
+    if max(at for at, _ in entries) > 255:
+        sys.exit("%d bytes of runs, a background has to start in the first "
+                 "256" % size)
+
+    out.write("const Background PROGMEM\n"
+              "gBackgrounds[NUM_BACKGROUNDS] = {\n   ")
+    for entry in entries:
+        out.write(" {%d, %d}," % entry)
+    out.write("\n};\n\n")
+
+    out.write("const color_t PROGMEM\n"
+              "gBackgroundPalette[%d] = {\n" % len(store))
+    for at in range(0, len(store), 8):
+        out.write("    " + " ".join("%s," % color_text(color)
+                                    for color in store[at:at + 8]) + "\n")
+    out.write("};\n\n")
+
+    out.write("const uint8_t PROGMEM\n"
+              "gBackgroundRuns[%d] = {\n" % size)
+    for packed in runs:
+        out.write("    " + " ".join("%s," % run for run, _ in packed) + "\n")
+    out.write("};\n\n#endif\n")
+
+    print("%d backgrounds in %d bytes of flash"
+          % (len(backgrounds), 2 * len(entries) + 2 * len(store) + size),
+          file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+"""
+Host client for the clock's serial commands.
+
+Usage: tools/clockctl.py [--port /dev/ttyUSB0] command...
+       tools/clockctl.py --sim ./clock_sim [--at 8] command...
+
+Each command is one line of the protocol in constants.h, eg:
+  tools/clockctl.py --port /dev/ttyUSB0 "T 12:34:56" "C h 1" G
+A command of "now" sends T with the host's time, and "watch" turns on
+telemetry and prints it until interrupted. The lines of a D trace dump
+are printed as they are, ready for tools/traceplot.py, and so are the
+lines of an I stats dump.
+
+With --port the commands go to the clock over a serial port at 38400 8N1,
+each one waiting for its answer. With --sim they are scripted into the
+simulator (make sim) instead, starting --at seconds into the run, once
+the ESC has armed, and the answers are printed as the run ends.
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+import termios
+import time
+
+BAUD = termios.B38400
+TIMEOUT = 1.0
+
+# Answers that come as several lines before the OK
+DUMPS = ("D ", "I ")
+
+
+def expand(commands):
+    for command in commands:
+        if command == "now":
+            yield time.strftime("T %H:%M:%S")
+        else:
+            yield command
+
+
+def open_port(path):
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+    attrs = termios.tcgetattr(fd)
+    attrs[0] = 0                                    # iflag, raw
+    attrs[1] = 0                                    # oflag
+    attrs[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+    attrs[3] = 0                                    # lflag, no echo
+    attrs[4] = attrs[5] = BAUD
+    attrs[6][termios.VMIN] = 0
+    attrs[6][termios.VTIME] = 1                     # reads wait 0.1 s
+    termios.tcsetattr(fd, termios.TCSANOW, attrs)
+    termios.tcflush(fd, termios.TCIOFLUSH)
+    return fd
+
+
+def read_line(fd, timeout):
+    line = b""
+    end = None if timeout is None else time.monotonic() + timeout
+    while end is None or time.monotonic() < end:
+        data = os.read(fd, 1)
+        if data == b"\n":
+            return line.decode(errors="replace").strip()
+        line += data
+    return None
+
+
+def run_port(path, commands):
+    fd = open_port(path)
+    ok = True
+    try:
+        for command in commands:
+            watch = command == "watch"
+            os.write(fd, (("R 1" if watch else command) + "\n").encode())
+            answer = read_line(fd, TIMEOUT)
+            while answer and answer.startswith(DUMPS):
+                print(answer)
+                answer = read_line(fd, TIMEOUT)
+            print("%s: %s" % (command, answer or "no answer"))
+            ok = ok and answer not in (None, "ERR")
+            while watch:
+                line = read_line(fd, None)
+                if line:
+                    print(line)
+    except KeyboardInterrupt:
+        os.write(fd, b"R 0\n")
+    finally:
+        os.close(fd)
+    return 0 if ok else 1
+
+
+def run_sim(binary, at, commands):
+    commands = [c for c in commands if c != "watch"]
+    with tempfile.NamedTemporaryFile("w", suffix=".txt") as script:
+        for i, command in enumerate(commands):
+            script.write("%.2f %s\n" % (at + 0.2 * i, command))
+        script.flush()
+
+        env = dict(os.environ, SIM_UART=script.name)
+        env.setdefault("SIM_SECONDS", "%.1f" % (at + 0.2 * len(commands) + 1))
+        out = subprocess.run([binary], env=env, capture_output=True,
+                             text=True, check=True).stdout
+
+    lines = [l[len("uart: "):] for l in out.splitlines()
+             if l.startswith("uart: ")]
+    answers = [l for l in lines if not l.startswith(("R ",) + DUMPS)]
+    for command, answer in zip(commands, answers):
+        print("%s: %s" % (command, answer))
+    for line in lines:
+        if line.startswith(("R ",) + DUMPS):
+            print(line)
+    return 0 if len(answers) >= len(commands) and "ERR" not in answers else 1
+
+
+def main():
+    p = argparse.ArgumentParser()
+    where = p.add_mutually_exclusive_group(required=True)
+    where.add_argument("--port")
+    where.add_argument("--sim")
+    p.add_argument("--at", type=float, default=8.0)
+    p.add_argument("commands", nargs="+")
+    args = p.parse_args()
+
+    commands = list(expand(args.commands))
+    if args.port:
+        return run_port(args.port, commands)
+    return run_sim(args.sim, args.at, commands)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,344 @@
+#!/usr/bin/env python3
+"""
+Static cycle counts for the clock's interrupt handlers.
+
+Usage: tools/isrcycles.py [--objdump avr-objdump] [--f-cpu N]
+                          [--resolution N] [--target-rps N] [--bcm-bits N]
+                          [--constants constants.h] clock
+
+Disassembles the ELF, walks every path through each ISR and the
+functions it calls, and prints min, mean and max cycles per ISR with
+the ATmega16 instruction timings. The mean is over paths, each path
+weighted the same. Counts include the 4 cycle interrupt response and
+the 3 cycle jmp in the vector table, so max is entry to reti.
+
+Every branch is walked, so every background and hand overlap is
+covered: the sector ISR only indexes the precomposed frame and has no
+path that depends on what is drawn in it.
+
+The sector ISR is also walked from its vector up to the out to PORTD
+on every path, the cycle the LEDs change on. That has to be the same
+on all of them, a naked entry with nothing but straight line code
+before the write.
+
+Checked against the budget from F_CPU, RESOLUTION, TARGET_RPS and
+BCM_BITS:
+  - TIMER0_COMP_vect must fit in SECTOR_ISR_CYCLES, read from
+    constants.h, the figure its #error check trusts.
+  - TIMER0_COMP_vect plus the longest other ISR, which it can be stuck
+    behind, must fit in the shortest BCM slot of a sector.
+  - TIMER0_COMP_vect writes PORTD at one fixed cycle.
+Exits 1 if any is broken, so it can gate a change to an ISR.
+
+Loops inside an ISR can not be bounded here and are reported as an
+error. Calls into the libgcc helpers use the worst case in LIBGCC. An
+indirect call is followed into every function ICALLS lists for the
+function making it, and counts as the worst of them. One that is not
+listed is an error, as is an ijmp: the firmware is built with
+-fno-jump-tables so a switch never becomes one.
+"""
+
+import argparse
+import bisect
+import re
+import subprocess
+import sys
+
+# ATmega16 vector numbers as used by avr-libc, __vector_N
+VECTORS = {
+    1: "INT0_vect", 2: "INT1_vect", 3: "TIMER2_COMP_vect",
+    4: "TIMER2_OVF_vect", 5: "TIMER1_CAPT_vect", 6: "TIMER1_COMPA_vect",
+    7: "TIMER1_COMPB_vect", 8: "TIMER1_OVF_vect", 9: "TIMER0_OVF_vect",
+    10: "SPI_STC_vect", 11: "USART_RXC_vect", 12: "USART_UDRE_vect",
+    13: "USART_TXC_vect", 14: "ADC_vect", 15: "EE_RDY_vect",
+    16: "ANA_COMP_vect", 17: "TWI_vect", 18: "INT2_vect",
+    19: "TIMER0_COMP_vect", 20: "SPM_RDY_vect",
+}
+SECTOR_ISR = "TIMER0_COMP_vect"
+
+# I/O address of PORTD, as objdump shows it in an out
+PORTD_IO = 0x12
+
+# Interrupt response plus the jmp in the vector table
+ENTRY_CYCLES = 4 + 3
+
+# Worst case of libgcc helpers that loop, from the libgcc sources
+LIBGCC = {
+    "__udivmodqi4": 90,
+    "__divmodqi4": 100,
+    "__udivmodhi4": 230,
+    "__divmodhi4": 250,
+    "__udivmodsi4": 720,
+    "__divmodsi4": 760,
+    "__mulsi3": 40,
+    "__mulhisi3": 30,
+    "__umulhisi3": 30,
+}
+
+# Indirect calls, by the function they are made from, and every function
+# they can land in. Keep in step with the code that sets the pointers.
+ICALLS = {
+    # The transaction callbacks, see the I2CTransaction set up in rtc.c
+    "i2c_finish": ("rtc_check_complete", "rtc_read_complete"),
+}
+
+CYCLES_2 = {
+    "adiw", "sbiw", "mul", "muls", "mulsu", "fmul", "fmuls", "fmulsu",
+    "ld", "ldd", "lds", "st", "std", "sts", "push", "pop", "rjmp",
+    "ijmp", "sbi", "cbi",
+}
+CYCLES_3 = {"rcall", "icall", "jmp", "lpm", "elpm"}
+CYCLES_4 = {"call", "ret", "reti"}
+SKIPS = {"cpse", "sbrc", "sbrs", "sbic", "sbis"}
+STOPS = {"ret", "reti"}
+
+SYMBOL = re.compile(r"^([0-9a-f]+) <([^>]+)>:$")
+INSN = re.compile(r"^\s*([0-9a-f]+):\s+((?:[0-9a-f]{2} )+)\s*(\S+)\s*([^;]*)(?:;\s*(.*))?$")
+TARGET = re.compile(r"0x([0-9a-f]+)")
+
+
+class Insn:
+    def __init__(self, addr, size, op, args, comment):
+        self.addr = addr
+        self.size = size
+        self.op = op
+        self.args = args.strip()
+        self.target = None
+        if op in ("rjmp", "rcall", "jmp", "call") or op.startswith("br"):
+            m = TARGET.search(comment or "") or TARGET.search(self.args)
+            if m:
+                self.target = int(m.group(1), 16)
+
+
+def disassemble(objdump, elf):
+    out = subprocess.run([objdump, "-d", elf], check=True,
+                         capture_output=True, text=True).stdout
+    insns = {}
+    symbols = {}
+    for line in out.splitlines():
+        m = SYMBOL.match(line)
+        if m:
+            symbols[m.group(2)] = int(m.group(1), 16)
+            continue
+        m = INSN.match(line)
+        if m:
+            addr = int(m.group(1), 16)
+            size = len(m.group(2).split())      # bytes
+            insns[addr] = Insn(addr, size, m.group(3), m.group(4), m.group(5))
+    return insns, symbols
+
+
+class Walker:
+    def __init__(self, insns, symbols):
+        self.insns = insns
+        self.symbols = symbols
+        self.names = {addr: name for name, addr in symbols.items()}
+        self.starts = sorted(self.names)
+        self.memo = {}
+        self.functions = {}
+
+    def function(self, addr):
+        """(min, max, paths, sum) from addr to ret/reti, calls included."""
+        if addr not in self.functions:
+            name = self.names.get(addr)
+            if name in LIBGCC:
+                cost = LIBGCC[name]
+                self.functions[addr] = (cost, cost, 1, cost)
+            else:
+                self.functions[addr] = self.walk(addr, set())
+        return self.functions[addr]
+
+    def containing(self, addr):
+        """Name of the function addr is in."""
+        i = bisect.bisect_right(self.starts, addr) - 1
+        return self.names[self.starts[i]] if i >= 0 else None
+
+    def indirect(self, addr):
+        """(min, max, paths, sum) over the functions an icall can reach."""
+        caller = self.containing(addr)
+        if caller not in ICALLS:
+            raise ValueError("indirect icall at 0x%x in %s, list what it "
+                             "calls in ICALLS" % (addr, caller))
+        result = None
+        for name in ICALLS[caller]:
+            if name not in self.symbols:
+                raise ValueError("%s, called from %s, not in the elf"
+                                 % (name, caller))
+            callee = self.function(self.symbols[name])
+            result = callee if result is None else self.either(result, callee)
+        return result
+
+    def walk(self, addr, active):
+        if addr in self.memo:
+            return self.memo[addr]
+        if addr in active:
+            raise ValueError("loop at 0x%x, can not bound it" % addr)
+        insn = self.insns.get(addr)
+        if insn is None:
+            raise ValueError("no instruction at 0x%x" % addr)
+        active.add(addr)
+
+        nxt = addr + insn.size
+        op = insn.op
+        if op in STOPS:
+            result = (4, 4, 1, 4)
+        elif op in ("icall", "eicall"):
+            result = self.add(3, self.chain(self.indirect(addr),
+                                            self.walk(nxt, active)))
+        elif op in ("ijmp", "eijmp"):
+            raise ValueError("indirect %s at 0x%x, can not follow it" % (op, addr))
+        elif op in ("rjmp", "jmp"):
+            cost = 2 if op == "rjmp" else 3
+            result = self.add(cost, self.walk(insn.target, active))
+        elif op in ("rcall", "call"):
+            cost = 3 if op == "rcall" else 4
+            callee = self.function(insn.target)
+            result = self.add(cost, self.chain(callee, self.walk(nxt, active)))
+        elif op.startswith("br"):
+            result = self.either(self.add(1, self.walk(nxt, active)),
+                                 self.add(2, self.walk(insn.target, active)))
+        elif op in SKIPS:
+            skipped = self.insns[nxt].size
+            over = nxt + skipped
+            result = self.either(self.add(1, self.walk(nxt, active)),
+                                 self.add(1 + skipped // 2,
+                                          self.walk(over, active)))
+        else:
+            cost = 4 if op in CYCLES_4 else 3 if op in CYCLES_3 else \
+                   2 if op in CYCLES_2 else 1
+            result = self.add(cost, self.walk(nxt, active))
+
+        active.discard(addr)
+        self.memo[addr] = result
+        return result
+
+    def port_writes(self, addr, cycles, active=frozenset()):
+        """Cycles from addr to the end of each path's out to PORTD."""
+        if addr in active:
+            raise ValueError("loop at 0x%x before the PORTD write" % addr)
+        insn = self.insns.get(addr)
+        if insn is None:
+            raise ValueError("no instruction at 0x%x" % addr)
+        active = active | {addr}
+
+        nxt = addr + insn.size
+        op = insn.op
+        if op == "out" and int(insn.args.split(",")[0], 0) == PORTD_IO:
+            return [cycles + 1]
+        if op in STOPS or op in ("rcall", "call", "ijmp", "icall"):
+            return []
+        if op in ("rjmp", "jmp"):
+            cost = 2 if op == "rjmp" else 3
+            return self.port_writes(insn.target, cycles + cost, active)
+        if op.startswith("br"):
+            return (self.port_writes(nxt, cycles + 1, active) +
+                    self.port_writes(insn.target, cycles + 2, active))
+        if op in SKIPS:
+            skipped = self.insns[nxt].size
+            return (self.port_writes(nxt, cycles + 1, active) +
+                    self.port_writes(nxt + skipped,
+                                     cycles + 1 + skipped // 2, active))
+        cost = 4 if op in CYCLES_4 else 3 if op in CYCLES_3 else \
+               2 if op in CYCLES_2 else 1
+        return self.port_writes(nxt, cycles + cost, active)
+
+    @staticmethod
+    def add(cost, r):
+        return (r[0] + cost, r[1] + cost, r[2], r[3] + cost * r[2])
+
+    @staticmethod
+    def chain(a, b):
+        return (a[0] + b[0], a[1] + b[1], a[2] * b[2],
+                a[3] * b[2] + b[3] * a[2])
+
+    @staticmethod
+    def either(a, b):
+        return (min(a[0], b[0]), max(a[1], b[1]), a[2] + b[2], a[3] + b[3])
+
+
+def main():
+    p = argparse.ArgumentParser()
+    p.add_argument("elf")
+    p.add_argument("--objdump", default="avr-objdump")
+    p.add_argument("--f-cpu", type=int, default=16000000)
+    p.add_argument("--resolution", type=int, default=180)
+    p.add_argument("--target-rps", type=int, default=62)
+    p.add_argument("--bcm-bits", type=int, default=1)
+    p.add_argument("--constants", default="constants.h")
+    args = p.parse_args()
+
+    with open(args.constants) as f:
+        m = re.search(r"#define\s+SECTOR_ISR_CYCLES\s+(\d+)", f.read())
+    if not m:
+        print("SECTOR_ISR_CYCLES not found in %s" % args.constants,
+              file=sys.stderr)
+        return 1
+    sector_isr_cycles = int(m.group(1))
+
+    insns, symbols = disassemble(args.objdump, args.elf)
+    walker = Walker(insns, symbols)
+    sector_cycles = args.f_cpu // (args.target_rps * args.resolution)
+    slot_cycles = sector_cycles // ((1 << args.bcm_bits) - 1)
+
+    rows = []
+    for num, name in sorted(VECTORS.items()):
+        addr = symbols.get("__vector_%d" % num)
+        if addr is None:
+            continue
+        try:
+            lo, hi, paths, total = walker.function(addr)
+        except ValueError as e:
+            print("%s: %s" % (name, e), file=sys.stderr)
+            return 1
+        rows.append((name, lo + ENTRY_CYCLES, total / paths + ENTRY_CYCLES,
+                     hi + ENTRY_CYCLES, paths))
+
+    print("F_CPU %d, RESOLUTION %d, TARGET_RPS %d, BCM_BITS %d: "
+          "%d cycles per sector, %d in the shortest slot"
+          % (args.f_cpu, args.resolution, args.target_rps, args.bcm_bits,
+             sector_cycles, slot_cycles))
+    print()
+    print("%-20s %6s %8s %6s %6s" % ("ISR", "min", "mean", "max", "paths"))
+    for name, lo, mean, hi, paths in rows:
+        print("%-20s %6d %8.1f %6d %6d" % (name, lo, mean, hi, paths))
+    print()
+
+    sector = [r for r in rows if r[0] == SECTOR_ISR]
+    if not sector:
+        print("%s not found in %s" % (SECTOR_ISR, args.elf), file=sys.stderr)
+        return 1
+    sector_max = sector[0][3]
+    other_max = max([r[3] for r in rows if r[0] != SECTOR_ISR] or [0])
+
+    num = [n for n, name in VECTORS.items() if name == SECTOR_ISR][0]
+    try:
+        writes = sorted(set(walker.port_writes(
+            symbols["__vector_%d" % num], ENTRY_CYCLES)))
+    except ValueError as e:
+        print("%s: %s" % (SECTOR_ISR, e), file=sys.stderr)
+        return 1
+    print("%s PORTD write at cycle %s"
+          % (SECTOR_ISR, ", ".join(str(w) for w in writes) or "none"))
+
+    ok = True
+    checks = (
+        ("%s max" % SECTOR_ISR, sector_max, sector_isr_cycles,
+         "SECTOR_ISR_CYCLES"),
+        ("%s max + longest other ISR" % SECTOR_ISR, sector_max + other_max,
+         slot_cycles, "shortest slot"),
+    )
+    for what, value, budget, against in checks:
+        good = value <= budget
+        ok = ok and good
+        print("%-4s %s: %d <= %d (%s)"
+              % ("ok" if good else "FAIL", what, value, budget, against))
+
+    good = len(writes) == 1
+    ok = ok and good
+    print("%-4s %s PORTD write at a fixed cycle"
+          % ("ok" if good else "FAIL", SECTOR_ISR))
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+"""
+Plots a revolution trace from the clock.
+
+Usage: tools/traceplot.py [--width N] [dump.txt]
+
+Reads the lines of a D dump, from a file or stdin, eg:
+  tools/clockctl.py --port /dev/ttyUSB0 "D 1"
+  ... wait for the display to tear ...
+  tools/clockctl.py --port /dev/ttyUSB0 D | tools/traceplot.py
+or with make sim TRACE=1:
+  tools/clockctl.py --sim ./clock_sim --at 1 "D 1" | tools/traceplot.py
+
+Each D line is one revolution, oldest first, see trace.h:
+  D <period> <sector ISRs> <OCR before> <OCR after> <latency> <flags>
+Lines that are not trace lines, and entries never written, are skipped.
+
+Prints one row a revolution. The bar is the period, scaled so the
+longest fills --width, and the mark at its end shows how the revolution
+went: = on time, < too few sector ISRs, > too many. Columns give the
+time from the first revolution, the period in us, the sector ISRs, the
+sector OCR it was shown with and the one worked out from it, the
+capture latency and the flags. The torn revolution the trigger stopped
+on is marked with an arrow.
+"""
+
+import argparse
+import re
+import sys
+
+TICK_US = 0.5               # TIMER 1 at F_CPU / 8, 16 MHz
+
+FLAGS = [
+    (0x01, "short"),
+    (0x02, "long"),
+    (0x04, "swap"),
+    (0x08, "slow"),
+    (0x10, "stretch"),
+]
+TORN = 0x03
+
+LINE = re.compile(r"(?:^|\s)D((?: \d+){6})\s*$")
+
+
+def parse(lines):
+    revs = []
+    for line in lines:
+        m = LINE.search(line)
+        if not m:
+            continue
+        period, slots, before, after, late, flags = map(int, m.group(1).split())
+        revs.append({"period": period, "slots": slots, "before": before,
+                     "after": after, "late": late, "flags": flags})
+    return revs
+
+
+def flag_names(flags):
+    return ",".join(name for bit, name in FLAGS if flags & bit) or "-"
+
+
+def plot(revs, width):
+    # A trigger stops recording half the ring after the torn revolution
+    trigger = revs[len(revs) - 1 - len(revs) // 2]
+    if not trigger["flags"] & TORN:
+        trigger = None
+    revs = [rev for rev in revs if rev["period"]]
+    longest = max(rev["period"] for rev in revs)
+
+    print("%3s %9s %8s %5s %7s %4s  %-*s %s"
+          % ("rev", "t ms", "us", "isrs", "ocr", "late", width, "period",
+             "flags"))
+    t = 0.0
+    for i, rev in enumerate(revs):
+        us = rev["period"] * TICK_US
+        bar = max(1, round(rev["period"] * width / longest))
+        mark = "<" if rev["flags"] & 0x01 else ">" if rev["flags"] & 0x02 else "="
+        print("%3d %9.1f %8.1f %5d %3d>%-3d %4d  %-*s %s%s"
+              % (i, t / 1000, us, rev["slots"], rev["before"], rev["after"],
+                 rev["late"], width, "#" * (bar - 1) + mark,
+                 flag_names(rev["flags"]),
+                 "  <-- trigger" if rev is trigger else ""))
+        t += us
+
+    torn = sum(1 for rev in revs if rev["flags"] & TORN)
+    print("%d revolutions, %d torn, period %.1f..%.1f us"
+          % (len(revs), torn, min(rev["period"] for rev in revs) * TICK_US,
+             longest * TICK_US))
+    if any(rev["period"] == 0xFFFF for rev in revs):
+        print("65535 ticks is the longest period the trace holds, "
+              "slower revolutions show as that")
+
+
+def main():
+    p = argparse.ArgumentParser()
+    p.add_argument("--width", type=int, default=40)
+    p.add_argument("dump", nargs="?")
+    args = p.parse_args()
+
+    if args.dump:
+        with open(args.dump) as f:
+            revs = parse(f)
+    else:
+        revs = parse(sys.stdin)
+
+    if not any(rev["period"] for rev in revs):
+        print("no trace lines", file=sys.stderr)
+        return 1
+    plot(revs, args.width)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,97 @@
+/*
+ * File:    trace.c
+ * Description: Revolution trace ring and its dump over the serial line,
+ *              see trace.h. Only built into the firmware with TRACE
+ *              defined.
+ */
+
+#ifdef TRACE
+
+#include <util/atomic.h>
+
+#include "trace.h"
+#include "uart.h"
+
+TraceRev gTrace[TRACE_DEPTH];
+uint8_t gTraceNext = 0;                 /* Oldest entry, written next */
+volatile uint8_t gTraceLeft = TRACE_RUN;
+uint8_t gTraceSend = 0;                 /* Entries of a dump still to go */
+uint8_t gTraceAt;                       /* Next entry a dump sends */
+
+
+/*
+ * Function:    trace_arm
+ * ----------------------
+ *  Starts recording again with the trigger armed, a dump under way is
+ *  dropped.
+ *
+ *  Modifies: gTraceLeft, gTraceSend
+ */
+void trace_arm(void)
+{
+    gTraceSend = 0;
+    gTraceLeft = TRACE_ARMED;
+}
+
+
+/*
+ * Function:    trace_dump
+ * -----------------------
+ *  Stops recording, if the trigger has not already, and starts sending
+ *  the ring from its oldest entry. trace_send sends it.
+ *
+ *  Modifies: gTraceLeft, gTraceSend, gTraceAt
+ */
+void trace_dump(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        gTraceLeft = 0;
+        gTraceAt = gTraceNext;
+    }
+    gTraceSend = TRACE_DEPTH;
+}
+
+
+/*
+ * Function:    trace_send
+ * -----------------------
+ *  Sends the next entry of a dump as a line
+ *      D <period> <sector ISRs> <OCR before> <OCR after> <latency> <flags>
+ *  and OK after the last, when recording starts again, free running.
+ *  One line a call so the UART ring never overflows. Returns 0 once
+ *  there is nothing left to send.
+ *
+ *  Modifies: gTraceSend, gTraceAt, gTraceLeft
+ */
+uint8_t trace_send(void)
+{
+    if (!gTraceSend)
+        return 0;
+
+    const TraceRev *rev = &gTrace[gTraceAt];
+    gTraceAt = (gTraceAt + 1) & (TRACE_DEPTH - 1);
+
+    uart_puts("D ");
+    uart_put_uint(rev->period);
+    uart_write(' ');
+    uart_put_uint(rev->slots);
+    uart_write(' ');
+    uart_put_uint(rev->ocr_before);
+    uart_write(' ');
+    uart_put_uint(rev->ocr_after);
+    uart_write(' ');
+    uart_put_uint(rev->late);
+    uart_write(' ');
+    uart_put_uint(rev->flags);
+    uart_puts("\r\n");
+
+    if (--gTraceSend)
+        return 1;
+
+    uart_puts("OK\r\n");
+    gTraceLeft = TRACE_RUN;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+ * Revolution trace, for working out why the display tore.
+ *
+ * Built with TRACE defined (make TRACE=1) the hall capture records one
+ * entry for every revolution into a ring of the last TRACE_DEPTH. It
+ * runs free until the trigger is armed, then the first torn revolution
+ * is kept in the middle of the ring: recording goes on for half the
+ * ring after it and stops, so what led up to it and what followed are
+ * both there. The D command sends the ring over the serial line, oldest
+ * first, and tools/traceplot.py plots it. Without TRACE every TRACE_
+ * macro is empty and none of this takes any flash, SRAM or cycles.
+ *
+ * The macros write straight into the ring so the capture ISR makes no
+ * calls for them. Periods are TIMER 1 ticks, F_CPU / 8.
+ */
+
+#include <stdint.h>
+
+#include "constants.h"
+
+/* Revolutions kept, must be a power of 2 */
+#define TRACE_DEPTH         16
+
+/* Entry flags */
+#define TRACE_SHORT         0x01    /* Fewer sector ISRs than the frame has */
+#define TRACE_LONG          0x02    /* Sector ISRs overran the frame */
+#define TRACE_SWAP          0x04    /* A new frame went up at the capture */
+#define TRACE_SLOW          0x08    /* TIMER 0 on a slower clock */
+#define TRACE_STRETCH       0x10    /* Period could not be split, stretched */
+#define TRACE_TORN          (TRACE_SHORT | TRACE_LONG)
+
+/* gTraceLeft states, below TRACE_ARMED it counts down to frozen at 0 */
+#define TRACE_RUN           0xFF    /* Records, never triggers */
+#define TRACE_ARMED         0xFE    /* Records until a torn revolution */
+
+typedef struct TraceRev
+{
+    uint16_t period;            /* TIMER 1 ticks, 0xFFFF too slow */
+    sector_t slots;             /* Sector ISRs the revolution took */
+    uint8_t ocr_before;         /* Sector OCR it was shown with */
+    uint8_t ocr_after;          /* Sector OCR worked out from it */
+    uint8_t late;               /* Capture latency, TIMER 1 ticks */
+    uint8_t flags;
+} TraceRev;
+
+#ifdef TRACE
+
+extern TraceRev gTrace[TRACE_DEPTH];
+extern uint8_t gTraceNext;
+extern volatile uint8_t gTraceLeft;
+
+void trace_arm(void);
+void trace_dump(void);
+uint8_t trace_send(void);
+
+#define TRACE_CAPTURE(isrs, expected, latency, ocr) \
+    do { if (gTraceLeft) { \
+             TraceRev *trace_rev = &gTrace[gTraceNext]; \
+             trace_rev->slots = (isrs); \
+             trace_rev->ocr_before = (ocr); \
+             trace_rev->late = (latency); \
+             trace_rev->flags = trace_rev->slots < (expected) ? TRACE_SHORT : \
+                                trace_rev->slots > (expected) ? TRACE_LONG : 0; \
+         } } while (0)
+#define TRACE_FLAG(flag) \
+    do { if (gTraceLeft) gTrace[gTraceNext].flags |= (flag); } while (0)
+#define TRACE_PERIOD(ticks, ocr) \
+    do { if (gTraceLeft) { \
+             TraceRev *trace_rev = &gTrace[gTraceNext]; \
+             trace_rev->period = (ticks); \
+             trace_rev->ocr_after = (ocr); \
+             gTraceNext = (gTraceNext + 1) & (TRACE_DEPTH - 1); \
+             if (gTraceLeft == TRACE_ARMED && (trace_rev->flags & TRACE_TORN)) \
+                 gTraceLeft = TRACE_DEPTH / 2 + 1; \
+             if (gTraceLeft < TRACE_ARMED) \
+                 gTraceLeft--; \
+         } } while (0)
+
+#else
+
+#define TRACE_CAPTURE(isrs, expected, latency, ocr)
+#define TRACE_FLAG(flag)
+#define TRACE_PERIOD(ticks, ocr)
+
+#endif
+
+#endif
@@ -0,0 +1,162 @@
+/*
+ * Interrupt driven USART driver, 8N1 at UART_BAUD.
+ *
+ * Received bytes are queued by USART_RXC_vect and sent bytes are drained
+ * by USART_UDRE_vect, so neither side ever waits on the hardware. When
+ * a ring is full the byte is dropped rather than waited on, the main
+ * loop and the display timing come before the serial line.
+ */
+
+#ifndef  F_CPU
+#define F_CPU 16000000UL
+#endif
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "hal.h"
+#include "uart.h"
+
+#define UBRR_VAL ((F_CPU / 16 / UART_BAUD) - 1)
+
+uint8_t gUartRx[UART_RX_SIZE];
+volatile uint8_t gUartRxHead = 0;
+volatile uint8_t gUartRxTail = 0;
+uint8_t gUartTx[UART_TX_SIZE];
+volatile uint8_t gUartTxHead = 0;
+volatile uint8_t gUartTxTail = 0;
+
+
+/*
+ * Function:    uart_init
+ * ----------------------
+ *  Sets the baud rate and enables the receiver, transmitter and the
+ *  receive interrupt. The data register empty interrupt is only on
+ *  while there is something to send.
+ *
+ *  Modifies: UBRRH, UBRRL, UCSRB, UCSRC
+ */
+void uart_init(void)
+{
+    UBRRH = (uint8_t)(UBRR_VAL >> 8);
+    UBRRL = (uint8_t)UBRR_VAL;
+    UCSRC = (1 << URSEL) | (1 << UCSZ1) | (1 << UCSZ0);    /* 8N1 */
+    UCSRB = (1 << RXEN) | (1 << TXEN) | (1 << RXCIE);
+}
+
+
+/*
+ * Function:    uart_read
+ * ----------------------
+ *  Takes the oldest received byte. Returns 0 if there is none.
+ *
+ *  Modifies: data, gUartRxTail
+ */
+uint8_t uart_read(uint8_t *data)
+{
+    uint8_t tail = gUartRxTail;
+
+    if (tail == gUartRxHead)
+        return 0;
+    *data = gUartRx[tail];
+    gUartRxTail = (tail + 1) & (UART_RX_SIZE - 1);
+    return 1;
+}
+
+
+/*
+ * Function:    uart_write
+ * -----------------------
+ *  Queues a byte to send. Returns 0 and drops it if the ring is full.
+ *
+ *  Modifies: gUartTxHead, UCSRB
+ */
+uint8_t uart_write(uint8_t data)
+{
+    uint8_t head = gUartTxHead;
+    uint8_t next = (head + 1) & (UART_TX_SIZE - 1);
+
+    if (next == gUartTxTail)
+        return 0;
+    gUartTx[head] = data;
+    gUartTxHead = next;
+    UCSRB |= (1 << UDRIE);
+    return 1;
+}
+
+
+/*
+ * Function:    uart_puts
+ * ----------------------
+ *  Queues a string, as much of it as fits.
+ */
+void uart_puts(const char *str)
+{
+    while (*str)
+        uart_write(*str++);
+}
+
+
+/*
+ * Function:    uart_put_uint
+ * --------------------------
+ *  Queues a number in decimal, without pulling in printf.
+ */
+void uart_put_uint(uint16_t value)
+{
+    char digits[5];
+    uint8_t n = 0;
+
+    do
+    {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+
+    while (n)
+        uart_write(digits[--n]);
+}
+
+
+/*
+ * Function:    ISR for USART_RXC vector
+ * -------------------------------------
+ *  Queues the received byte. Reading UDR clears the interrupt, so it is
+ *  read even when the ring is full and the byte has to be dropped.
+ *
+ *  Modifies: gUartRx, gUartRxHead
+ */
+ISR(USART_RXC_vect)
+{
+    uint8_t data = HAL_UDR_READ();
+    uint8_t head = gUartRxHead;
+    uint8_t next = (head + 1) & (UART_RX_SIZE - 1);
+
+    if (next != gUartRxTail)
+    {
+        gUartRx[head] = data;
+        gUartRxHead = next;
+    }
+}
+
+
+/*
+ * Function:    ISR for USART_UDRE vector
+ * --------------------------------------
+ *  Sends the next queued byte, or turns itself off when the ring is
+ *  empty.
+ *
+ *  Modifies: gUartTxTail, UDR, UCSRB
+ */
+ISR(USART_UDRE_vect)
+{
+    uint8_t tail = gUartTxTail;
+
+    if (tail == gUartTxHead)
+    {
+        UCSRB &= ~(1 << UDRIE);
+        return;
+    }
+    HAL_UDR_WRITE(gUartTx[tail]);
+    gUartTxTail = (tail + 1) & (UART_TX_SIZE - 1);
+}
@@ -0,0 +1,18 @@
+#ifndef UART_H
+#define UART_H
+
+#include <stdint.h>
+
+#define UART_BAUD 38400UL
+
+/* Ring buffer sizes, must be powers of 2 */
+#define UART_RX_SIZE 32
+#define UART_TX_SIZE 64
+
+void uart_init(void);
+uint8_t uart_read(uint8_t *data);
+uint8_t uart_write(uint8_t data);
+void uart_puts(const char *str);
+void uart_put_uint(uint16_t value);
+
+#endif